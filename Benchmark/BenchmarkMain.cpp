@@ -0,0 +1,609 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Headless SigGenEngine Benchmark.
+ *
+ *  Drives the engine's getNextAudioBlock() with synthetic AudioSourceChannelInfo buffers (no audio device, no GUI)
+ *  and sweeps voice count, generator mix, block size, channel count and sample rate. Results are written as JSON:
+ *  ns per output sample, ns per voice-sample and voices-per-core (how many voices one core could run in real time).
+ *
+ *  Usage:
+ *      SigGenBenchmark [--voices=1,8,64,256] [--mix=sine,square,...] [--blocks=64,512] [--channels=2,16]
+ *                      [--rates=48000,96000] [--seconds=0.5] [--output=results.json]
+ *                      [--baseline=baseline.json] [--tolerance=0.10]
+ *
+ *  Also reported: std::sin vs polynomial SinPi vs quadrature oscillator accuracy/cost, ToneMeter (Goertzel bank) cost
+ *  and level accuracy against the number of tracked tones, the audio thread cost of a SceneManager scene switch, and
+ *  OutputConverter cost per sample for each integer format, dither and noise shaping setting.
+ *
+ *  With --baseline, every configuration also present in the baseline is compared and any that got slower by more than
+ *  --tolerance (fractional) is flagged as a REGRESSION. The exit code is then non-zero, so it can gate CI.
+ */
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+#include "SigGenEngine.h"
+#include "MultitoneGenerator.h"
+#include "Oversampler.h"
+#include "ArbitraryWaveformGenerator.h"
+#include "ToneMeter.h"
+#include "ChirpGenerator.h"
+#include "SceneManager.h"
+#include "OutputConverter.h"
+#include "stdio.h"
+
+//==============================================================================
+namespace
+{
+    typedef struct BenchConfig_S{
+        juce::String mix;
+        int voices = 1;
+        int blockSize = 512;
+        int channels = 2;
+        double sampleRate = 48000.0;
+    }bench_config_t;
+
+    typedef struct BenchResult_S{
+        bench_config_t config;
+        double nsPerSample = 0.0;           //Per output frame (all channels)
+        double nsPerVoiceSample = 0.0;
+        double voicesPerCore = 0.0;
+    }bench_result_t;
+
+    const char* const ALL_MIXES[] = { "sine", "quadrature", "square", "noise", "square_os4x", "multitone", "chirp", "fm", "awg", "mixed" };
+
+    juce::String GetConfigKey( const bench_config_t& c )
+    {
+        return c.mix + " voices=" + juce::String(c.voices) + " block=" + juce::String(c.blockSize)
+             + " ch=" + juce::String(c.channels) + " fs=" + juce::String((int)c.sampleRate);
+    }
+
+    /*
+     *  Writes a mono 16 bit WAV of a few harmonics for the awg mix to play back.
+     */
+    bool WriteTestWav( const juce::File& file, double sampleRate, double seconds )
+    {
+        const juce::uint32 nFrames = (juce::uint32)(sampleRate * seconds);
+        const juce::uint32 dataBytes = nFrames * 2;
+        std::vector<unsigned char> wav( 44 + (size_t)dataBytes );
+
+        auto put32 = [&wav]( size_t at, juce::uint32 v ){ for( int b = 0; b < 4; b++ ) wav[at + b] = (unsigned char)(v >> (8 * b)); };
+        auto put16 = [&wav]( size_t at, juce::uint32 v ){ wav[at] = (unsigned char)v; wav[at + 1] = (unsigned char)(v >> 8); };
+        std::memcpy( &wav[0], "RIFF", 4 );  put32( 4, 36 + dataBytes );   std::memcpy( &wav[8], "WAVE", 4 );
+        std::memcpy( &wav[12], "fmt ", 4 ); put32( 16, 16 );              put16( 20, 1 );     //PCM
+        put16( 22, 1 );                     put32( 24, (juce::uint32)sampleRate );
+        put32( 28, (juce::uint32)sampleRate * 2 );                        put16( 32, 2 );     put16( 34, 16 );
+        std::memcpy( &wav[36], "data", 4 ); put32( 40, dataBytes );
+
+        for( juce::uint32 n = 0; n < nFrames; n++ ){
+            const double t = (double)n / sampleRate;
+            const double y = 0.5 * std::sin( 2.0 * juce::MathConstants<double>::pi * 997.0 * t )
+                           + 0.2 * std::sin( 2.0 * juce::MathConstants<double>::pi * 2991.0 * t )
+                           + 0.1 * std::sin( 2.0 * juce::MathConstants<double>::pi * 4985.0 * t );
+            put16( 44 + 2 * (size_t)n, (juce::uint32)(juce::int16)std::lround( y * 32767.0 ) );
+        }
+        return file.replaceWithData( wav.data(), wav.size() );
+    }
+
+    /*
+     *  Builds the voices for one configuration and registers them with the engine. Owns everything it creates.
+     */
+    class VoiceSet
+    {
+    public:
+        VoiceSet( const bench_config_t& config, SigGenEngine& engine )
+        {
+            const float level = 0.5f / (float)config.voices;
+
+            if( config.mix == "multitone" ){      //One generator carrying config.voices tones.
+                auto* multitone = new MultitoneGenerator();
+                multitone->SetSampleRate( (float)config.sampleRate );
+                const unsigned int usableBins = multitone->GetFrameSize() / 2 - 2;
+                const unsigned int spacing = std::max( 1u, usableBins / (unsigned int)config.voices );
+                for( int tone = 0; tone < config.voices; tone++ )
+                    multitone->SetBin( 1 + ((unsigned int)tone * spacing) % usableBins, 1.0f / (float)config.voices, 0.0f );
+                multitone->ApplyPhaseSet( MultitoneGenerator::PHASE_SET_SCHROEDER );
+                multitone->Commit();
+                Own(multitone, level * (float)config.voices);
+                engine.AddVoice(multitone);
+                return;
+            }
+
+            if( config.mix == "fm" ){             //2 operator FM pairs (modulator -> carrier), CrossModulationGroup::MAX_OPERATORS per group.
+                for( int v = 0; v < config.voices; v += (int)CrossModulationGroup::MAX_OPERATORS ){
+                    modulationGroups.emplace_back( new CrossModulationGroup() );
+                    CrossModulationGroup* fm = modulationGroups.back().get();
+                    const int nOperators = std::min( config.voices - v, (int)CrossModulationGroup::MAX_OPERATORS );
+                    for( int op = 0; op < nOperators; op++ ){
+                        auto* osc = new SineWaveOscillator();
+                        Own(osc, level);
+                        periodic.push_back(osc);
+                        fm->AddOperator(osc);
+                        if( op & 1 )
+                            fm->SetModulation( (unsigned int)op - 1, (unsigned int)op, CrossModulationGroup::MODULATION_FM, 2000.0f / level );
+                    }
+                    fm->Commit();
+                    engine.AddModulationGroup(fm);
+                }
+                return;
+            }
+
+            if( config.mix == "awg" ){            //File playback: every voice loops the same WAV at its own fractional rate.
+                waveFile.reset( new juce::TemporaryFile(".wav") );
+                if( !WriteTestWav( waveFile->getFile(), config.sampleRate, 2.0 ) )
+                    return;
+                for( int v = 0; v < config.voices; v++ ){
+                    auto* awg = new ArbitraryWaveformGenerator();
+                    awg->SetSampleRate( (float)config.sampleRate );
+                    awg->SetPlaybackRate( 1.0 + 0.37 * (double)v / (double)config.voices );
+                    awg->SetLoop(true);
+                    awg->SetStartOffset( ((juce::uint64)v * 997) % (juce::uint64)config.sampleRate );
+                    if( !awg->OpenWavFile( waveFile->getFile() ) ){
+                        delete awg;
+                        continue;
+                    }
+                    Own(awg, level);
+                    engine.AddVoice(awg);
+                }
+                return;
+            }
+
+            if( config.mix == "square_os4x" ){
+                group.reset( new OversampledVoiceGroup( OversampledVoiceGroup::OVERSAMPLING_4X ) );
+                engine.AddVoiceGroup( group.get() );
+            }
+
+            for( int v = 0; v < config.voices; v++ ){
+                juce::String type = config.mix;
+                if( type == "mixed" )
+                    type = juce::String( ALL_MIXES[v % 4] );     //sine, quadrature, square, noise
+
+                if( type == "noise" ){
+                    auto* noise = new WhiteNoiseGen();
+                    Own(noise, level);
+                    engine.AddVoice(noise);
+                    continue;
+                }
+
+                if( type == "chirp" ){
+                    auto* chirp = new ChirpGenerator();
+                    chirp->SetSampleRate(config.sampleRate);
+                    ChirpGenerator::sweep_settings_t sweep;
+                    sweep.seconds = 1.0;
+                    sweep.repeat = true;
+                    chirp->SetSweep(sweep);
+                    chirp->Start();
+                    Own(chirp, level);
+                    engine.AddVoice(chirp);
+                    continue;
+                }
+
+                PeriodicOscillator* osc;
+                if( type == "quadrature" )
+                    osc = new QuadratureOscillator();
+                else if( type == "sine" )
+                    osc = new SineWaveOscillator();
+                else
+                    osc = new SquareWaveOscillator();
+
+                Own(osc, level);
+                periodic.push_back(osc);
+                if( group )
+                    group->AddVoice(osc);
+                else
+                    engine.AddVoice(osc);
+            }
+        }
+
+        //Frequencies need the sample rate, so they are set once the engine has been prepared.
+        void SetFrequencies( void )
+        {
+            for( size_t v = 0; v < periodic.size(); v++ )
+                periodic[v]->SetFrequency( 110.0f + 37.0f * (float)v );
+        }
+
+    private:
+        std::unique_ptr<juce::TemporaryFile> waveFile;         //Declared first: outlives the voices mapping it.
+        std::vector<std::unique_ptr<SigGen>> owned;
+        std::vector<PeriodicOscillator*> periodic;
+        std::unique_ptr<OversampledVoiceGroup> group;
+        std::vector<std::unique_ptr<CrossModulationGroup>> modulationGroups;
+
+        void Own( SigGen* voice, float level ){
+            voice->SetAmplitude(level);
+            owned.emplace_back(voice);
+        }
+    };
+
+    bench_result_t RunConfig( const bench_config_t& config, double seconds )
+    {
+        SigGenEngine engine;
+        VoiceSet voiceSet( config, engine );
+        engine.prepareToPlay( config.blockSize, config.sampleRate );
+        voiceSet.SetFrequencies();
+
+        juce::AudioBuffer<float> buffer( config.channels, config.blockSize );
+        juce::AudioSourceChannelInfo info;
+        info.buffer = &buffer;
+        info.startSample = 0;
+        info.numSamples = config.blockSize;
+
+        const int nBlocks = std::max( 1, (int)(seconds * config.sampleRate) / config.blockSize );
+        for( int b = 0; b < 16; b++ )        //Warm up (and let the amplitude ramps finish).
+            engine.getNextAudioBlock(info);
+
+        //Best of a few repetitions, to reject scheduler noise.
+        static const int N_REPEATS = 3;
+        double bestSeconds = 1e30;
+        for( int r = 0; r < N_REPEATS; r++ ){
+            const juce::int64 start = juce::Time::getHighResolutionTicks();
+            for( int b = 0; b < nBlocks; b++ )
+                engine.getNextAudioBlock(info);
+            const juce::int64 end = juce::Time::getHighResolutionTicks();
+            bestSeconds = std::min( bestSeconds, juce::Time::highResolutionTicksToSeconds(end - start) );
+        }
+
+        bench_result_t result;
+        result.config = config;
+        result.nsPerSample = bestSeconds * 1e9 / ((double)nBlocks * config.blockSize);
+        result.nsPerVoiceSample = result.nsPerSample / (double)config.voices;
+        result.voicesPerCore = (1e9 / config.sampleRate) / result.nsPerVoiceSample;
+        return result;
+    }
+
+    /*
+     *  Sine path accuracy and cost in isolation: std::sin (SineWaveOscillator::getSample), the polynomial SinPi block
+     *  kernel (SineWaveOscillator::RenderModulatedBlock) and the rotating phasor (QuadratureOscillator).
+     *  Error is against a double precision sinusoid at the same (float) phase increment.
+     */
+    juce::var RunOscillatorComparison( double seconds )
+    {
+        static const float FS = 48000.0f, FREQ = 997.0f;
+        const int nSamples = (int)(seconds * FS);
+        const double angleDelta = (double)((FREQ / FS) * juce::MathConstants<float>::twoPi);
+
+        static const char* names[] = { "std::sin", "polynomial_sinpi", "quadrature_phasor" };
+        static const unsigned int BLOCK_SIZE = 512;
+        std::vector<float> block( BLOCK_SIZE );
+
+        juce::Array<juce::var> entries;
+        for( int type = 0; type < 3; type++ ){
+            std::unique_ptr<PeriodicOscillator> osc;
+            if( type < 2 )  osc.reset( new SineWaveOscillator() );
+            else            osc.reset( new QuadratureOscillator() );
+            osc->SetSampleRate(FS);
+            osc->SetFrequency(FREQ);
+            osc->AdvanceGlide(0);               //Not rendered by an engine, so the frequency is applied here.
+            osc->SetAmplitude(1.0f);
+            for( int n = 0; n < 1024; n++ )     //Amplitude ramp
+                osc->getSample();
+
+            //The polynomial path only exists as a block kernel, so it is rendered BLOCK_SIZE samples at a time.
+            auto render = [&]( float* dest, unsigned int numSamples ){
+                if( type == 1 ){
+                    osc->RenderModulatedBlock( dest, nullptr, nullptr, numSamples );
+                }else{
+                    for( unsigned int i = 0; i < numSamples; i++ )
+                        dest[i] = osc->getSample();
+                }
+            };
+
+            //SineWaveOscillator outputs sin(phase), the quadrature I output is cos(phase). Both start at phase 0.
+            double maxError = 0.0;
+            for( int n = 1024; n < nSamples + 1024; n += (int)BLOCK_SIZE ){
+                const unsigned int count = (unsigned int)std::min( (int)BLOCK_SIZE, nSamples + 1024 - n );
+                render( block.data(), count );
+                for( unsigned int i = 0; i < count; i++ ){
+                    const double phase = angleDelta * (double)(n + (int)i);
+                    const double reference = (type < 2) ? std::sin(phase) : std::cos(phase);
+                    maxError = std::max( maxError, std::abs( (double)block[i] - reference ) );
+                }
+            }
+
+            float sink = 0.0f;
+            const juce::int64 start = juce::Time::getHighResolutionTicks();
+            for( int n = 0; n < nSamples; n += (int)BLOCK_SIZE ){
+                const unsigned int count = (unsigned int)std::min( (int)BLOCK_SIZE, nSamples - n );
+                render( block.data(), count );
+                for( unsigned int i = 0; i < count; i++ )
+                    sink += block[i];
+            }
+            const juce::int64 end = juce::Time::getHighResolutionTicks();
+
+            auto* entry = new juce::DynamicObject();
+            entry->setProperty( "oscillator", names[type] );
+            entry->setProperty( "seconds", seconds );
+            entry->setProperty( "max_abs_error", maxError );
+            entry->setProperty( "ns_per_sample", juce::Time::highResolutionTicksToSeconds(end - start) * 1e9 / nSamples );
+            entry->setProperty( "checksum", (double)sink );
+            entries.add( juce::var(entry) );
+        }
+        return juce::var(entries);
+    }
+
+    /*
+     *  ToneMeter cost vs number of tracked tones, and its level accuracy on a multitone made from the same oscillators.
+     */
+    juce::var RunToneMeterBenchmark( double seconds )
+    {
+        static const double FS = 48000.0;
+        static const int BLOCK_SIZE = 512;
+        const int nBlocks = std::max( 1, (int)(seconds * FS / BLOCK_SIZE) );
+        const int toneCounts[] = { 1, 8, 64 };
+
+        juce::Array<juce::var> entries;
+        for( int nTones : toneCounts ){
+            std::vector<std::unique_ptr<SineWaveOscillator>> oscs;
+            ToneMeter meter;
+            const float amplitude = 1.0f / (float)nTones;
+            for( int k = 0; k < nTones; k++ ){
+                oscs.emplace_back( new SineWaveOscillator() );
+                oscs.back()->SetSampleRate((float)FS);
+                oscs.back()->SetFrequency( 100.0f + 293.7f * (float)k );
+                oscs.back()->AdvanceGlide(0);
+                oscs.back()->SetAmplitude(amplitude);
+                meter.AddTone( oscs.back().get() );
+            }
+            meter.Prepare(FS);
+
+            std::vector<float> signal( (size_t)nBlocks * BLOCK_SIZE, 0.0f );
+            for( float& sample : signal )
+                for( auto& osc : oscs )
+                    sample += osc->getSample();
+
+            const juce::int64 start = juce::Time::getHighResolutionTicks();
+            for( int b = 0; b < nBlocks; b++ )
+                meter.ProcessBlock( signal.data() + (size_t)b * BLOCK_SIZE, BLOCK_SIZE );
+            const juce::int64 end = juce::Time::getHighResolutionTicks();
+
+            std::vector<ToneMeter::tone_result_t> results( (size_t)nTones );
+            meter.GetResults( results.data(), (unsigned int)nTones );
+            double maxLevelError = 0.0;
+            for( const ToneMeter::tone_result_t& r : results )
+                maxLevelError = std::max( maxLevelError, std::abs( (double)r.levelDb - 20.0 * std::log10(amplitude) ) );
+
+            const double nsPerSample = juce::Time::highResolutionTicksToSeconds(end - start) * 1e9 / ((double)nBlocks * BLOCK_SIZE);
+            auto* entry = new juce::DynamicObject();
+            entry->setProperty( "tones", nTones );
+            entry->setProperty( "window_seconds", meter.GetWindowSeconds() );
+            entry->setProperty( "windows", (int)meter.GetWindowCount() );
+            entry->setProperty( "ns_per_sample", nsPerSample );
+            entry->setProperty( "ns_per_tone_sample", nsPerSample / nTones );
+            entry->setProperty( "max_level_error_db", maxLevelError );
+            entries.add( juce::var(entry) );
+        }
+        return juce::var(entries);
+    }
+
+    /*
+     *  Audio thread cost of switching between stored scenes: one recall per block, instant and crossfaded.
+     */
+    juce::var RunSceneSwitchBenchmark( void )
+    {
+        static const double FS = 48000.0;
+        static const int BLOCK_SIZE = 64;
+        static const int N_SCENES = 512;
+        static const int N_SWITCHES = 20000;
+        const int voiceCounts[] = { 8, 64, 256 };
+
+        juce::Array<juce::var> entries;
+        for( int nVoices : voiceCounts ){
+            std::vector<std::unique_ptr<SineWaveOscillator>> oscs;
+            SceneManager scenes;
+            for( int v = 0; v < nVoices; v++ ){
+                oscs.emplace_back( new SineWaveOscillator() );
+                oscs.back()->SetSampleRate((float)FS);
+                scenes.AddVoice( oscs.back().get() );
+            }
+            scenes.Prepare(FS);
+
+            std::vector<SceneManager::scene_voice_t> sceneVoices( (size_t)nVoices );
+            for( int s = 0; s < N_SCENES; s++ ){
+                for( int v = 0; v < nVoices; v++ ){
+                    sceneVoices[(size_t)v].level = 0.01f * (float)((s + v) % 10);
+                    sceneVoices[(size_t)v].frequency = 100.0f + 3.0f * (float)s + 17.0f * (float)v;
+                    sceneVoices[(size_t)v].muted = ((s + v) % 4) == 0;
+                }
+                scenes.StoreScene( (unsigned int)s, sceneVoices.data(), (unsigned int)nVoices );
+            }
+
+            auto* entry = new juce::DynamicObject();
+            entry->setProperty( "voices", nVoices );
+            entry->setProperty( "scenes", N_SCENES );
+
+            const float crossfades[] = { 0.0f, 0.05f };
+            for( float crossfadeSeconds : crossfades ){
+                double audioSeconds = 0.0;
+                for( int i = 0; i < N_SWITCHES; i++ ){
+                    scenes.RecallScene( (unsigned int)((i * 97) % N_SCENES), crossfadeSeconds );
+                    const juce::int64 start = juce::Time::getHighResolutionTicks();
+                    scenes.ProcessBlock( BLOCK_SIZE );
+                    audioSeconds += juce::Time::highResolutionTicksToSeconds( juce::Time::getHighResolutionTicks() - start );
+                }
+                entry->setProperty( crossfadeSeconds > 0.0f ? "ns_per_crossfade_block" : "ns_per_switch", audioSeconds * 1e9 / N_SWITCHES );
+            }
+            entries.add( juce::var(entry) );
+        }
+        return juce::var(entries);
+    }
+
+    /*
+     *  OutputConverter cost per sample for each integer format, dither and noise shaping setting (stereo, 512 blocks).
+     */
+    juce::var RunOutputConversionBenchmark( double seconds )
+    {
+        static const double FS = 48000.0;
+        static const int BLOCK_SIZE = 512;
+        static const int CHANNELS = 2;
+        const int nBlocks = std::max( 1, (int)(seconds * FS / BLOCK_SIZE) );
+        const char* const formatNames[] = { "int16", "int24", "int32" };
+        const char* const shapingNames[] = { "none", "first_order", "second_order" };
+
+        juce::AudioBuffer<float> buffer( CHANNELS, BLOCK_SIZE );
+        for( int ch = 0; ch < CHANNELS; ch++ ){
+            SineWaveOscillator osc;
+            osc.SetSampleRate((float)FS);
+            osc.SetFrequency( 997.0f * (float)(ch + 1) );
+            osc.AdvanceGlide(0);
+            osc.SetAmplitude(0.5f);
+            for( int n = 0; n < BLOCK_SIZE; n++ )
+                buffer.setSample( ch, n, osc.getSample() );
+        }
+        std::vector<uint8_t> output( (size_t)4 * CHANNELS * BLOCK_SIZE );
+
+        juce::Array<juce::var> entries;
+        OutputConverter converter;
+        for( int format = OutputConverter::FORMAT_INT16; format <= OutputConverter::FORMAT_INT32; format++ ){
+            for( int dither = OutputConverter::DITHER_NONE; dither <= OutputConverter::DITHER_TPDF; dither++ ){
+                for( int shaping = OutputConverter::NOISE_SHAPING_NONE; shaping <= OutputConverter::NOISE_SHAPING_SECOND_ORDER; shaping++ ){
+                    if( format == OutputConverter::FORMAT_INT32 && (dither != OutputConverter::DITHER_NONE || shaping != OutputConverter::NOISE_SHAPING_NONE) )
+                        continue;       //Not applied to int32
+
+                    converter.SetFormat( (OutputConverter::sample_format_t)format, (OutputConverter::dither_t)dither, (OutputConverter::noise_shaping_t)shaping );
+                    const juce::int64 start = juce::Time::getHighResolutionTicks();
+                    for( int b = 0; b < nBlocks; b++ )
+                        converter.ConvertBlock( buffer, 0, BLOCK_SIZE, output.data() );
+                    const juce::int64 end = juce::Time::getHighResolutionTicks();
+
+                    auto* entry = new juce::DynamicObject();
+                    entry->setProperty( "format", formatNames[format] );
+                    entry->setProperty( "dither", dither == OutputConverter::DITHER_TPDF ? "tpdf" : "none" );
+                    entry->setProperty( "noise_shaping", shapingNames[shaping] );
+                    entry->setProperty( "ns_per_sample", juce::Time::highResolutionTicksToSeconds(end - start) * 1e9 / ((double)nBlocks * BLOCK_SIZE * CHANNELS) );
+                    entries.add( juce::var(entry) );
+                }
+            }
+        }
+        return juce::var(entries);
+    }
+
+    juce::var ResultToVar( const bench_result_t& r )
+    {
+        auto* obj = new juce::DynamicObject();
+        obj->setProperty( "key", GetConfigKey(r.config) );
+        obj->setProperty( "mix", r.config.mix );
+        obj->setProperty( "voices", r.config.voices );
+        obj->setProperty( "block_size", r.config.blockSize );
+        obj->setProperty( "channels", r.config.channels );
+        obj->setProperty( "sample_rate", r.config.sampleRate );
+        obj->setProperty( "ns_per_sample", r.nsPerSample );
+        obj->setProperty( "ns_per_voice_sample", r.nsPerVoiceSample );
+        obj->setProperty( "voices_per_core", r.voicesPerCore );
+        return juce::var(obj);
+    }
+
+    juce::Array<int> ParseIntList( const juce::String& list )
+    {
+        juce::Array<int> values;
+        for( const juce::String& token : juce::StringArray::fromTokens(list, ",", "") )
+            values.add( token.trim().getIntValue() );
+        return values;
+    }
+
+    //Returns the number of regressions found.
+    int CompareWithBaseline( const juce::Array<bench_result_t>& results, const juce::File& baselineFile, double tolerance )
+    {
+        const juce::var baselineResults = juce::JSON::parse(baselineFile)["results"];
+        if( !baselineResults.isArray() ){
+            printf("ERROR: Could not read baseline results from %s\r\n", baselineFile.getFullPathName().toRawUTF8());
+            return 1;
+        }
+
+        int regressions = 0, compared = 0;
+        for( const bench_result_t& r : results ){
+            const juce::String key = GetConfigKey(r.config);
+            for( const juce::var& b : *baselineResults.getArray() ){
+                if( b["key"].toString() != key )
+                    continue;
+
+                compared++;
+                const double baseNs = (double)b["ns_per_sample"];
+                const double change = (r.nsPerSample - baseNs) / baseNs;
+                if( change > tolerance ){
+                    printf("REGRESSION: %-48s %9.2f -> %9.2f ns/sample (%+.1f%%)\r\n", key.toRawUTF8(), baseNs, r.nsPerSample, change * 100.0);
+                    regressions++;
+                }
+                break;
+            }
+        }
+        printf("Baseline comparison: %d configs compared, %d regressions (tolerance %.1f%%)\r\n", compared, regressions, tolerance * 100.0);
+        return regressions;
+    }
+}
+
+//==============================================================================
+int main( int argc, char* argv[] )
+{
+    juce::ArgumentList args( argc, argv );
+
+    if( args.containsOption("--help|-h") ){
+        printf("SigGenBenchmark [--voices=1,8,64,256] [--mix=sine,quadrature,square,noise,square_os4x,multitone,chirp,fm,mixed]\r\n"
+               "                [--blocks=64,512] [--channels=2,16] [--rates=48000,96000] [--seconds=0.5]\r\n"
+               "                [--output=results.json] [--baseline=baseline.json] [--tolerance=0.10]\r\n");
+        return 0;
+    }
+
+    auto option = [&args]( const char* name, const char* defaultValue ){
+        return args.containsOption(name) ? args.getValueForOption(name) : juce::String(defaultValue);
+    };
+
+    const juce::Array<int> voiceCounts = ParseIntList( option("--voices", "1,8,64,256") );
+    const juce::Array<int> blockSizes  = ParseIntList( option("--blocks", "64,512") );
+    const juce::Array<int> channels    = ParseIntList( option("--channels", "2,16") );
+    const juce::Array<int> rates       = ParseIntList( option("--rates", "48000,96000") );
+    const double seconds   = option("--seconds", "0.5").getDoubleValue();
+    const double tolerance = option("--tolerance", "0.10").getDoubleValue();
+
+    juce::StringArray mixes;
+    if( args.containsOption("--mix") )
+        mixes = juce::StringArray::fromTokens( args.getValueForOption("--mix"), ",", "" );
+    else
+        for( const char* mix : ALL_MIXES ) mixes.add(mix);
+
+    juce::Array<bench_result_t> results;
+    juce::Array<juce::var> resultVars;
+    for( const juce::String& mix : mixes )
+    for( int nVoices : voiceCounts )
+    for( int blockSize : blockSizes )
+    for( int nChannels : channels )
+    for( int rate : rates ){
+        bench_config_t config;
+        config.mix = mix.trim();
+        config.voices = nVoices;
+        config.blockSize = blockSize;
+        config.channels = nChannels;
+        config.sampleRate = (double)rate;
+
+        const bench_result_t r = RunConfig( config, seconds );
+        printf("%-48s %9.2f ns/sample %8.2f ns/voice-sample %10.1f voices/core\r\n",
+               GetConfigKey(config).toRawUTF8(), r.nsPerSample, r.nsPerVoiceSample, r.voicesPerCore);
+        results.add(r);
+        resultVars.add( ResultToVar(r) );
+    }
+
+    auto* root = new juce::DynamicObject();
+    root->setProperty( "results", juce::var(resultVars) );
+    root->setProperty( "oscillator_comparison", RunOscillatorComparison( std::max(seconds, 1.0) * 60.0 ) );
+    root->setProperty( "tone_meter", RunToneMeterBenchmark( std::max(seconds, 1.0) ) );
+    root->setProperty( "scene_switch", RunSceneSwitchBenchmark() );
+    root->setProperty( "output_conversion", RunOutputConversionBenchmark( std::max(seconds, 1.0) ) );
+    const juce::var rootVar(root);
+
+    const juce::String json = juce::JSON::toString(rootVar);
+    if( args.containsOption("--output") ){
+        const juce::File outputFile = juce::File::getCurrentWorkingDirectory().getChildFile( args.getValueForOption("--output") );
+        outputFile.replaceWithText(json);
+        printf("Results written to %s\r\n", outputFile.getFullPathName().toRawUTF8());
+    }else{
+        printf("%s\r\n", json.toRawUTF8());
+    }
+
+    if( args.containsOption("--baseline") ){
+        const juce::File baselineFile = juce::File::getCurrentWorkingDirectory().getChildFile( args.getValueForOption("--baseline") );
+        if( CompareWithBaseline( results, baselineFile, tolerance ) > 0 )
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,525 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Arbitrary Waveform Generator (Memory Mapped File Playback).
+ *
+ *  Plays back long captured/synthesised waveforms (WAV, RF64 or headerless raw) as a normal SigGen voice.
+ *  - The file is memory mapped rather than loaded, so opening is instant regardless of file size.
+ *  - A background thread madvise()s and touches the pages just ahead of the play position (and the loop start),
+ *    so the audio thread reads resident memory rather than page faulting.
+ *  - Looping, start offset and fractional playback rate (which also absorbs file vs output sample rate differences).
+ *  - Fractional positions use a polyphase windowed-sinc interpolator. Each output sample is two 16 tap dot products
+ *    (adjacent phases, linearly blended) over contiguous, aligned float data, which the compiler vectorises.
+ *
+ *  Samples are converted to float and interpolated in blocks of RENDER_BLOCK_SIZE; CalcSample() just reads them out.
+ *
+ *  Control calls (open, close, rate, loop, restart) come from one thread at a time. Nothing the audio thread is reading
+ *  is changed under it: the loop region and start offset are validated on the control side and published with each
+ *  restart, restarts and new interpolation kernels are picked up at its next block, and Close() stops it reading the
+ *  file before unmapping it.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+#include "stdio.h"
+
+#if ! JUCE_WINDOWS
+ #include <sys/mman.h>
+ #include <unistd.h>
+#endif
+
+class ArbitraryWaveformGenerator : public SigGen
+{
+public:
+
+    typedef enum{
+        SAMPLE_FORMAT_INT16,
+        SAMPLE_FORMAT_INT24,
+        SAMPLE_FORMAT_INT32,
+        SAMPLE_FORMAT_FLOAT32,
+    }sample_format_t;
+
+    static constexpr double MAX_PLAYBACK_RATE = 16.0;
+
+    ArbitraryWaveformGenerator() : prefetcher(*this)
+    {
+        BuildKernel( kernels[audioKernel], 1.0 );
+        renderBuffer.fill(0.0f);
+        scratch.resize( (size_t)(RENDER_BLOCK_SIZE * MAX_PLAYBACK_RATE) + INTERP_TAPS + 2 );
+    }
+    ~ArbitraryWaveformGenerator(){ Close(); }
+
+    /*
+     *  Open a WAV (or RF64) file. Only the header is read; sample data is paged in on demand.
+     */
+    bool OpenWavFile( const juce::File& file, unsigned int channel = 0 )
+    {
+        Close();
+        if( !MapFile(file) )
+            return false;
+
+        if( !ParseWavHeader() || channel >= numChannels ){
+            printf("WARNING: %s is not a supported WAV file\r\n", file.getFullPathName().toRawUTF8());
+            Close();
+            return false;
+        }
+
+        selectedChannel = channel;
+        return StartPlayback();
+    }
+
+    bool OpenRawFile( const juce::File& file, sample_format_t format, unsigned int channels, double fileSampleRate,
+                      juce::uint64 headerBytes = 0, unsigned int channel = 0 )
+    {
+        Close();
+        if( channels == 0 || channel >= channels || !MapFile(file) )
+            return false;
+
+        sampleFormat = format;
+        numChannels = channels;
+        fileRate = fileSampleRate;
+        dataOffset = headerBytes;
+        frameStride = numChannels * GetBytesPerSample(format);
+        lengthFrames = ((juce::uint64)mappedFile->getSize() > headerBytes) ? ((juce::uint64)mappedFile->getSize() - headerBytes) / frameStride : 0;
+        selectedChannel = channel;
+        return StartPlayback();
+    }
+
+    /*
+     *  Stop requests the audio thread stop reading at its next block; the block in progress (if any) is waited for
+     *  before the file is unmapped. Doesn't depend on audio running.
+     */
+    void Close( void )
+    {
+        playing.store(false);
+        while( rendering.load() )
+            std::this_thread::yield();
+
+        prefetcher.stopThread(1000);
+        mappedFile.reset();
+        data = nullptr;
+        lengthFrames = 0;
+    }
+
+    bool IsOpen( void ) const { return data != nullptr && lengthFrames > 0; }
+    juce::uint64 GetLengthFrames( void ) const { return lengthFrames; }
+    double GetFileSampleRate( void ) const { return fileRate; }
+    bool IsFinished( void ) const { return finished; }
+
+    void SetSampleRate( float rate ){
+        fS = rate;
+        UpdateIncrement();
+    }
+
+    //1.0 = original pitch/speed. Clamped to (0, MAX_PLAYBACK_RATE].
+    void SetPlaybackRate( double rate ){
+        playbackRate = juce::jlimit( 1.0e-6, MAX_PLAYBACK_RATE, rate );
+        UpdateIncrement();
+    }
+
+    //Loop region in frames. end == 0 means the end of the file. Applied by Restart() (and by opening a file).
+    void SetLoop( bool enabled, juce::uint64 start = 0, juce::uint64 end = 0 ){
+        looping = enabled;
+        loopStart = start;
+        loopEnd = end;
+    }
+
+    //Applied by Restart() (and by opening a file).
+    void SetStartOffset( juce::uint64 frame ){ startOffset = frame; }
+
+    /*
+     *  Clamps the loop region and start offset to the open file and publishes them; the audio thread restarts from them
+     *  at its next block. An empty region (e.g. no file open) doesn't loop.
+     */
+    void Restart( void )
+    {
+        play_settings_t& settings = playSettings[editSettings];
+        settings.loopEnd = ( loopEnd == 0 || loopEnd > lengthFrames ) ? lengthFrames : loopEnd;
+        settings.loopStart = loopStart < settings.loopEnd ? loopStart : 0;
+        settings.looping = looping && settings.loopEnd > settings.loopStart;
+        settings.startOffset = std::min( startOffset, lengthFrames );
+
+        prefetchLoopStart.store( settings.loopStart, std::memory_order_relaxed );
+        prefetchLoopEnd.store( settings.looping ? settings.loopEnd : 0, std::memory_order_relaxed );
+        editSettings = publishedSettings.exchange( editSettings | SETTINGS_NEW, std::memory_order_acq_rel ) & ~SETTINGS_NEW;
+    }
+
+    float CalcSample() override
+    {
+        if( renderPosition >= RENDER_BLOCK_SIZE ){
+            RenderBlock();
+            renderPosition = 0;
+        }
+        return amplitude * renderBuffer[renderPosition++];
+    }
+
+private:
+    static constexpr unsigned int RENDER_BLOCK_SIZE = 256;
+    static constexpr unsigned int INTERP_TAPS = 16;                 //Source samples per output sample
+    static constexpr unsigned int INTERP_HALF = INTERP_TAPS / 2;
+    static constexpr unsigned int INTERP_PHASES = 128;              //Fractional positions in the kernel table
+    static constexpr unsigned int INTERP_LANES = 8;                 //SIMD width the dot products are written for
+    static constexpr size_t READAHEAD_BYTES = 8 * 1024 * 1024;
+    static constexpr int PREFETCH_INTERVAL_MS = 5;
+
+    typedef struct alignas(64) Kernel_S{
+        float taps[INTERP_PHASES + 1][INTERP_TAPS];     //+1 phase so phase p + 1 always exists for the blend.
+    }kernel_t;
+
+    typedef struct PlaySettings_S{
+        bool looping = false;
+        juce::uint64 loopStart = 0, loopEnd = 0;        //Validated: loopStart < loopEnd <= lengthFrames whenever looping.
+        juce::uint64 startOffset = 0;
+    }play_settings_t;
+
+    //File
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    const unsigned char* data = nullptr;
+    juce::uint64 dataOffset = 0, lengthFrames = 0;
+    unsigned int numChannels = 1, selectedChannel = 0, frameStride = 2;
+    sample_format_t sampleFormat = SAMPLE_FORMAT_INT16;
+    double fileRate = 48000.0;
+
+    //Playback
+    float fS = 48000;
+    double playbackRate = 1.0;
+    std::atomic<double> increment { 1.0 };      //Source frames per output sample.
+    bool looping = false;                                   //Control side, as set (published by Restart())
+    juce::uint64 loopStart = 0, loopEnd = 0, startOffset = 0;
+    juce::int64 positionFrame = 0;
+    double positionFraction = 0.0;
+    bool finished = false;
+    std::atomic<juce::uint64> playFrame { 0 };      //For the prefetcher.
+    std::atomic<juce::uint64> prefetchLoopStart { 0 }, prefetchLoopEnd { 0 };      //loopEnd 0: not looping
+
+    //Audio thread handshake.
+    std::atomic<bool> playing { false };            //Cleared by Close(): stop reading the file.
+    std::atomic<bool> rendering { false };          //Set while the audio thread is inside RenderBlock().
+
+    /*
+     *  Restarts hand the validated settings over through three slots, the same way as the kernels below: Restart()
+     *  fills its own slot and swaps it into publishedSettings flagged SETTINGS_NEW, and the audio thread swaps its slot
+     *  for it (and restarts) at the next block.
+     */
+    static constexpr int SETTINGS_NEW = 0x4;
+    play_settings_t playSettings[3];
+    std::atomic<int> publishedSettings { 1 };
+    int editSettings = 0, audioSettings = 2;
+
+    /*
+     *  Interpolator. The cutoff changes with the rate, so kernels are handed over through three slots: the control
+     *  thread builds into its own slot and swaps it into publishedKernel flagged KERNEL_NEW; the audio thread
+     *  acknowledges by swapping its slot for it at the next block. A slot is never rebuilt while the audio thread has it.
+     */
+    static constexpr int KERNEL_NEW = 0x4;
+    kernel_t kernels[3];
+    std::atomic<int> publishedKernel { 1 };
+    int editKernel = 0, audioKernel = 2;
+    double publishedCutoffScale = 1.0;              //Control side
+    std::vector<float> scratch;
+    std::array<float, RENDER_BLOCK_SIZE> renderBuffer;
+    unsigned int renderPosition = RENDER_BLOCK_SIZE;
+
+    //==========================================================================
+    class PagePrefetcher : public juce::Thread
+    {
+    public:
+        PagePrefetcher( ArbitraryWaveformGenerator& o ) : juce::Thread("AWG Prefetch"), owner(o) {}
+
+        void run() override
+        {
+            while( !threadShouldExit() ){
+                const juce::uint64 frame = owner.playFrame.load(std::memory_order_relaxed);
+                const juce::uint64 loopEnd = owner.prefetchLoopEnd.load(std::memory_order_relaxed);
+                owner.PrefetchFrames( frame, READAHEAD_BYTES );
+                if( loopEnd != 0 && frame + READAHEAD_BYTES / owner.frameStride >= loopEnd )
+                    owner.PrefetchFrames( owner.prefetchLoopStart.load(std::memory_order_relaxed), READAHEAD_BYTES );       //About to wrap
+                wait(PREFETCH_INTERVAL_MS);
+            }
+        }
+    private:
+        ArbitraryWaveformGenerator& owner;
+    };
+    PagePrefetcher prefetcher;
+
+    //==========================================================================
+    bool MapFile( const juce::File& file )
+    {
+        mappedFile.reset( new juce::MemoryMappedFile( file, juce::MemoryMappedFile::readOnly ) );
+        data = static_cast<const unsigned char*>( mappedFile->getData() );
+        if( data == nullptr ){
+            printf("WARNING: Could not map %s\r\n", file.getFullPathName().toRawUTF8());
+            mappedFile.reset();
+            return false;
+        }
+#if ! JUCE_WINDOWS
+        madvise( const_cast<unsigned char*>(data), mappedFile->getSize(), MADV_SEQUENTIAL );
+#endif
+        return true;
+    }
+
+    bool StartPlayback( void )
+    {
+        if( !IsOpen() ){
+            Close();
+            return false;
+        }
+        UpdateIncrement();
+        const juce::uint64 firstFrame = std::min( startOffset, lengthFrames );
+        playFrame.store( firstFrame, std::memory_order_relaxed );
+        PrefetchFrames( firstFrame, 256 * 1024 );      //Small synchronous prefetch, so the first blocks are resident.
+        prefetcher.startThread();
+
+        Restart();
+        playing.store(true);
+        return true;
+    }
+
+    //Audio thread (a newly published playSettings slot).
+    void ApplyRestart( void )
+    {
+        positionFrame = (juce::int64)playSettings[audioSettings].startOffset;
+        positionFraction = 0.0;
+        finished = false;
+        playFrame.store( (juce::uint64)positionFrame, std::memory_order_relaxed );
+    }
+
+    static unsigned int GetBytesPerSample( sample_format_t format )
+    {
+        switch( format ){
+            case SAMPLE_FORMAT_INT16:   return 2;
+            case SAMPLE_FORMAT_INT24:   return 3;
+            case SAMPLE_FORMAT_INT32:   return 4;
+            case SAMPLE_FORMAT_FLOAT32: return 4;
+        }
+        return 2;
+    }
+
+    static juce::uint32 ReadLE32( const unsigned char* p ){ return (juce::uint32)p[0] | ((juce::uint32)p[1] << 8) | ((juce::uint32)p[2] << 16) | ((juce::uint32)p[3] << 24); }
+    static juce::uint16 ReadLE16( const unsigned char* p ){ return (juce::uint16)(p[0] | (p[1] << 8)); }
+    static juce::uint64 ReadLE64( const unsigned char* p ){ return (juce::uint64)ReadLE32(p) | ((juce::uint64)ReadLE32(p + 4) << 32); }
+
+    bool ParseWavHeader( void )
+    {
+        const juce::uint64 size = (juce::uint64)mappedFile->getSize();
+        if( size < 12 || std::memcmp(data + 8, "WAVE", 4) != 0 )
+            return false;
+
+        const bool isRF64 = std::memcmp(data, "RF64", 4) == 0;
+        if( !isRF64 && std::memcmp(data, "RIFF", 4) != 0 )
+            return false;
+
+        juce::uint64 rf64DataSize = 0, dataSize = 0;
+        bool haveFormat = false, haveData = false;
+        unsigned int bitsPerSample = 0, formatTag = 0;
+
+        juce::uint64 chunk = 12;
+        while( chunk + 8 <= size && !haveData ){
+            const unsigned char* header = data + chunk;
+            const juce::uint64 chunkSize = ReadLE32(header + 4);
+            const unsigned char* body = header + 8;
+            const bool bodyInFile = chunkSize <= size - (chunk + 8);      //Only the data chunk may be truncated.
+
+            if( std::memcmp(header, "ds64", 4) == 0 ){
+                if( chunkSize < 16 || !bodyInFile )
+                    return false;
+                rf64DataSize = ReadLE64(body + 8);
+            }else if( std::memcmp(header, "fmt ", 4) == 0 ){
+                if( chunkSize < 16 || !bodyInFile )
+                    return false;
+                formatTag = ReadLE16(body);
+                numChannels = ReadLE16(body + 2);
+                fileRate = (double)ReadLE32(body + 4);
+                bitsPerSample = ReadLE16(body + 14);
+                if( formatTag == 0xFFFE ){          //WAVE_FORMAT_EXTENSIBLE: real tag is the start of the sub-format GUID.
+                    if( chunkSize < 26 )
+                        return false;
+                    formatTag = ReadLE16(body + 24);
+                }
+                haveFormat = true;
+            }else if( std::memcmp(header, "data", 4) == 0 ){
+                dataOffset = chunk + 8;
+                dataSize = (isRF64 && chunkSize == 0xFFFFFFFF) ? rf64DataSize : chunkSize;
+                haveData = true;
+            }
+            chunk += 8 + chunkSize + (chunkSize & 1);       //Chunks are word aligned.
+        }
+
+        if( !haveFormat || !haveData || numChannels == 0 )
+            return false;
+
+        if( formatTag == 1 && bitsPerSample == 16 )         sampleFormat = SAMPLE_FORMAT_INT16;
+        else if( formatTag == 1 && bitsPerSample == 24 )    sampleFormat = SAMPLE_FORMAT_INT24;
+        else if( formatTag == 1 && bitsPerSample == 32 )    sampleFormat = SAMPLE_FORMAT_INT32;
+        else if( formatTag == 3 && bitsPerSample == 32 )    sampleFormat = SAMPLE_FORMAT_FLOAT32;
+        else return false;
+
+        frameStride = numChannels * GetBytesPerSample(sampleFormat);
+        dataSize = std::min( dataSize, size - dataOffset );     //Truncated files play what's there.
+        lengthFrames = dataSize / frameStride;
+        return true;
+    }
+
+    //Called from the prefetch thread (and once at startup).
+    void PrefetchFrames( juce::uint64 frame, size_t bytes )
+    {
+        if( !IsOpen() || frame >= lengthFrames )
+            return;
+
+        const juce::uint64 fileSize = (juce::uint64)mappedFile->getSize();
+        const juce::uint64 start = dataOffset + frame * frameStride;
+        const juce::uint64 end = std::min( fileSize, start + bytes );
+#if ! JUCE_WINDOWS
+        static const juce::uint64 pageSize = (juce::uint64)sysconf(_SC_PAGESIZE);
+#else
+        static const juce::uint64 pageSize = 4096;
+#endif
+        const juce::uint64 alignedStart = start & ~(pageSize - 1);
+#if ! JUCE_WINDOWS
+        madvise( const_cast<unsigned char*>(data) + alignedStart, (size_t)(end - alignedStart), MADV_WILLNEED );
+#endif
+        //madvise is only a hint: touching each page guarantees it's resident before the audio thread gets there.
+        volatile unsigned char sink = 0;
+        for( juce::uint64 page = alignedStart; page < end; page += pageSize )
+            sink = sink + data[page];
+    }
+
+    void UpdateIncrement( void )
+    {
+        const double inc = juce::jlimit( 1.0e-6, MAX_PLAYBACK_RATE, playbackRate * fileRate / (double)fS );
+        increment.store(inc, std::memory_order_relaxed);
+
+        //Anti-aliasing: when reading faster than 1:1 the kernel cutoff has to drop accordingly.
+        const double cutoffScale = std::min( 1.0, 1.0 / inc );
+        if( cutoffScale != publishedCutoffScale ){
+            BuildKernel( kernels[editKernel], cutoffScale );
+            editKernel = publishedKernel.exchange( editKernel | KERNEL_NEW, std::memory_order_acq_rel ) & ~KERNEL_NEW;
+            publishedCutoffScale = cutoffScale;
+        }
+    }
+
+    //Blackman windowed sinc. Tap t of phase p weights source frame (i - INTERP_HALF + 1 + t) for a position i + p / INTERP_PHASES.
+    static void BuildKernel( kernel_t& kernel, double cutoffScale )
+    {
+        static constexpr double PI_D = 3.141592653589793238L;
+        const double cutoff = 0.45 * cutoffScale;       //Normalised to the source rate (0.5 = Nyquist)
+
+        for( unsigned int p = 0; p <= INTERP_PHASES; p++ ){
+            const double fraction = (double)p / (double)INTERP_PHASES;
+            double sum = 0.0;
+            for( unsigned int t = 0; t < INTERP_TAPS; t++ ){
+                const double x = (double)t - (double)(INTERP_HALF - 1) - fraction;
+                const double sinc = (x == 0.0) ? 2.0 * cutoff : std::sin( 2.0 * PI_D * cutoff * x ) / (PI_D * x);
+                const double w = (x + INTERP_HALF) / (double)INTERP_TAPS;      //0..1 across the span
+                const double window = 0.42 - 0.5 * std::cos( 2.0 * PI_D * w ) + 0.08 * std::cos( 4.0 * PI_D * w );
+                kernel.taps[p][t] = (float)(sinc * window);
+                sum += kernel.taps[p][t];
+            }
+            for( unsigned int t = 0; t < INTERP_TAPS; t++ )         //Unity DC gain at every phase
+                kernel.taps[p][t] = (float)(kernel.taps[p][t] / sum);
+        }
+    }
+
+    inline float ReadSourceFrame( juce::int64 frame ) const
+    {
+        const play_settings_t& settings = playSettings[audioSettings];
+        if( settings.looping ){
+            const juce::int64 start = (juce::int64)settings.loopStart, end = (juce::int64)settings.loopEnd;
+            if( frame >= end || frame < start )
+                frame = start + (((frame - start) % (end - start)) + (end - start)) % (end - start);
+        }else if( frame < 0 || frame >= (juce::int64)lengthFrames ){
+            return 0.0f;
+        }
+
+        const unsigned char* p = data + dataOffset + (juce::uint64)frame * frameStride + selectedChannel * GetBytesPerSample(sampleFormat);
+        switch( sampleFormat ){
+            case SAMPLE_FORMAT_INT16:   return (float)(juce::int16)ReadLE16(p) * (1.0f / 32768.0f);
+            case SAMPLE_FORMAT_INT24:   return (float)((juce::int32)(((juce::uint32)p[0] << 8) | ((juce::uint32)p[1] << 16) | ((juce::uint32)p[2] << 24)) >> 8) * (1.0f / 8388608.0f);
+            case SAMPLE_FORMAT_INT32:   return (float)(juce::int32)ReadLE32(p) * (1.0f / 2147483648.0f);
+            case SAMPLE_FORMAT_FLOAT32: { float f; std::memcpy(&f, p, 4); return f; }
+        }
+        return 0.0f;
+    }
+
+    //rendering/playing are sequentially consistent (with Close()), so once Close() has seen rendering clear, no later block reads the file.
+    void RenderBlock( void )
+    {
+        rendering.store(true);
+        const bool isPlaying = playing.load();
+        if( isPlaying ){
+            if( publishedSettings.load(std::memory_order_relaxed) & SETTINGS_NEW ){
+                audioSettings = publishedSettings.exchange( audioSettings, std::memory_order_acq_rel ) & ~SETTINGS_NEW;
+                ApplyRestart();
+            }
+            if( publishedKernel.load(std::memory_order_relaxed) & KERNEL_NEW )
+                audioKernel = publishedKernel.exchange( audioKernel, std::memory_order_acq_rel ) & ~KERNEL_NEW;
+        }
+
+        if( isPlaying && !finished )
+            InterpolateBlock();
+        else
+            renderBuffer.fill(0.0f);
+        rendering.store(false);
+    }
+
+    void InterpolateBlock( void )
+    {
+        const double inc = increment.load(std::memory_order_relaxed);
+        const kernel_t& kernel = kernels[audioKernel];
+
+        //Convert every source frame this block touches into contiguous floats.
+        const juce::int64 firstFrame = positionFrame - (juce::int64)(INTERP_HALF - 1);
+        const double spanFrames = positionFraction + inc * (RENDER_BLOCK_SIZE - 1);
+        const juce::int64 numFrames = (juce::int64)spanFrames + INTERP_TAPS + 1;
+        for( juce::int64 i = 0; i < numFrames; i++ )
+            scratch[(size_t)i] = ReadSourceFrame( firstFrame + i );
+
+        //Polyphase interpolation. The tap loops are fixed length over contiguous floats and vectorise.
+        double position = positionFraction;         //Relative to positionFrame
+        for( unsigned int n = 0; n < RENDER_BLOCK_SIZE; n++ ){
+            const juce::int64 whole = (juce::int64)position;
+            const double fraction = position - (double)whole;
+            const double phasePosition = fraction * INTERP_PHASES;
+            const unsigned int phase = (unsigned int)phasePosition;
+            const float blend = (float)(phasePosition - (double)phase);
+
+            const float* x = scratch.data() + whole;
+            const float* k0 = kernel.taps[phase];
+            const float* k1 = kernel.taps[phase + 1];
+
+            //Explicit lanes (rather than one running sum) so the multiply-adds vectorise without needing -ffast-math.
+            float lanes0[INTERP_LANES] = {}, lanes1[INTERP_LANES] = {};
+            for( unsigned int t = 0; t < INTERP_TAPS; t += INTERP_LANES ){
+                for( unsigned int l = 0; l < INTERP_LANES; l++ ){
+                    lanes0[l] += x[t + l] * k0[t + l];
+                    lanes1[l] += x[t + l] * k1[t + l];
+                }
+            }
+            float y0 = 0.0f, y1 = 0.0f;
+            for( unsigned int l = 0; l < INTERP_LANES; l++ ){
+                y0 += lanes0[l];
+                y1 += lanes1[l];
+            }
+            renderBuffer[n] = y0 + blend * (y1 - y0);
+            position += inc;
+        }
+
+        //Advance, wrapping into the loop (or stopping at the end of the file).
+        const juce::int64 advance = (juce::int64)position;
+        positionFraction = position - (double)advance;
+        positionFrame += advance;
+        const play_settings_t& settings = playSettings[audioSettings];
+        if( settings.looping ){
+            const juce::int64 start = (juce::int64)settings.loopStart, end = (juce::int64)settings.loopEnd;
+            if( positionFrame >= end )
+                positionFrame = start + (positionFrame - start) % (end - start);
+        }else if( positionFrame >= (juce::int64)lengthFrames + (juce::int64)INTERP_HALF ){
+            finished = true;
+        }
+
+        playFrame.store( (juce::uint64)std::max<juce::int64>(0, positionFrame), std::memory_order_relaxed );
+    }
+};
@@ -0,0 +1,273 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Swept Sine (Chirp) Generator.
+ *
+ *  Sweeping a PeriodicOscillator by calling SetFrequency() jumps the phase increment at every call (zipper noise) and
+ *  the timing depends on when the calls happen. Here the phase is a closed form function of the sample index since the
+ *  sweep started, so every sample is exactly where the sweep says it should be, with no accumulated drift:
+ *
+ *      Exponential (Farina):   phase(t) = 2pi * f1 * L * (e^(t/L) - 1),     L = T / ln(f2 / f1)
+ *      Linear:                 phase(t) = 2pi * (f1 * t + (f2 - f1) * t^2 / 2T)
+ *
+ *  Samples are rendered in blocks of RENDER_BLOCK_SIZE (CalcSample() just reads them out, as ArbitraryWaveformGenerator).
+ *  Per block, the phase at the block start is evaluated exactly (double). Within the block the linear sweep is a
+ *  quadratic in the sample offset, and the exponential sweep is the block start value times a precomputed e^(m / fs.L)
+ *  table, so there is no per-sample recursion and no per-sample transcendental: both loops and the polynomial sine
+ *  vectorise. RenderBlock() renders straight into a buffer for offline use (much faster than real time).
+ *
+ *  Optional raised cosine fade in/out, silent gap and repeat. CreateInverseFilter() makes the matching deconvolution
+ *  filter (time reversed sweep, with the 6dB/octave amplitude correction for exponential sweeps), so the impulse response of the
+ *  system under test is capture convolved with the inverse filter.
+ *
+ *  READING:
+ *  1) Farina, "Simultaneous Measurement of Impulse Response and Distortion with a Swept-Sine Technique", AES 108, 2000
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+#include "stdio.h"
+
+class ChirpGenerator : public SigGen
+{
+public:
+
+    typedef enum{
+        SWEEP_EXPONENTIAL,      //Equal time per octave. Pink spectrum, separates harmonic distortion in the deconvolved response.
+        SWEEP_LINEAR,           //Equal time per Hz. White spectrum.
+    }sweep_type_t;
+
+    typedef struct SweepSettings_S{
+        sweep_type_t type = SWEEP_EXPONENTIAL;
+        double startHz = 20.0;
+        double endHz = 20000.0;
+        double seconds = 10.0;          //Sweep length, including the fades
+        double fadeSeconds = 0.0;       //Raised cosine fade in and out
+        double gapSeconds = 0.0;        //Silence after each sweep
+        bool repeat = false;
+    }sweep_settings_t;
+
+    ChirpGenerator(){}
+    ~ChirpGenerator(){}
+
+    void SetSampleRate( double rate ){ fS = rate; }
+
+    /*
+     *  Writes the pending settings. Call Start() to publish them; the sweep (re)starts at the next render block.
+     *  Don't call again while a Start() is still pending.
+     */
+    bool SetSweep( const sweep_settings_t& settings )
+    {
+        if( settings.seconds <= 0.0 || settings.startHz < 0.0 || settings.endHz < 0.0 ){
+            printf("WARNING: Invalid Sweep Settings\r\n");
+            return false;
+        }
+        if( settings.type == SWEEP_EXPONENTIAL && ( settings.startHz <= 0.0 || settings.endHz <= 0.0 || settings.startHz == settings.endHz ) ){
+            printf("WARNING: Exponential Sweep needs distinct, non-zero start and end frequencies\r\n");
+            return false;
+        }
+        pendingSettings = settings;
+        return true;
+    }
+
+    void Start( void ){ startPending.store(true, std::memory_order_release); }
+    void Stop( void ){ stopPending.store(true, std::memory_order_release); }
+    bool IsFinished( void ) const { return finished.load(std::memory_order_acquire); }
+
+    //Instantaneous frequency t seconds into the sweep (e.g. to label a capture).
+    static double FrequencyAt( const sweep_settings_t& s, double t )
+    {
+        t = juce::jlimit( 0.0, s.seconds, t );
+        if( s.type == SWEEP_LINEAR )
+            return s.startHz + (s.endHz - s.startHz) * t / s.seconds;
+        return s.startHz * std::exp( t * std::log( s.endHz / s.startHz ) / s.seconds );
+    }
+
+    float CalcSample() override
+    {
+        if( renderPosition >= RENDER_BLOCK_SIZE ){
+            RenderChunk( renderBuffer, RENDER_BLOCK_SIZE );
+            renderPosition = 0;
+        }
+        return amplitude * renderBuffer[renderPosition++];
+    }
+
+    //Offline/block rendering. Equivalent to numSamples calls to getSample().
+    void RenderBlock( float* dest, unsigned int numSamples )
+    {
+        unsigned int n = 0;
+        while( n < numSamples && renderPosition < RENDER_BLOCK_SIZE )       //Drain anything CalcSample() left behind
+            dest[n++] = getSample();
+
+        while( numSamples - n >= RENDER_BLOCK_SIZE ){
+            RenderChunk( dest + n, RENDER_BLOCK_SIZE );
+            ApplyAmplitude( dest + n, RENDER_BLOCK_SIZE );
+            n += RENDER_BLOCK_SIZE;
+        }
+
+        while( n < numSamples )
+            dest[n++] = getSample();
+    }
+
+    /*
+     *  Deconvolution filter for a sweep (allocates; not for the audio thread). Normalised so a sweep played straight
+     *  into the capture deconvolves to a unit peak.
+     */
+    static void CreateInverseFilter( const sweep_settings_t& settings, double sampleRate, std::vector<float>& filter )
+    {
+        ChirpGenerator sweep;
+        sweep.SetSampleRate(sampleRate);
+        sweep.SetAmplitude(1.0f);
+        sweep.SetSweep(settings);
+        sweep.Start();
+
+        const unsigned int length = (unsigned int)std::llround( settings.seconds * sampleRate );
+        std::vector<float> forward(length);
+        sweep.amplitude = 1.0f;         //No ramp
+        sweep.rampRemainingSamples = 0;
+        sweep.RenderBlock( forward.data(), length );
+
+        //Exponential: the sweep spends time proportional to 1 / f at each frequency (pink), so the filter's amplitude is
+        //proportional to f (6dB/octave) and the pair deconvolves to a flat response.
+        const double L = settings.type == SWEEP_EXPONENTIAL ? settings.seconds / std::log( settings.endHz / settings.startHz ) : 0.0;
+        filter.resize(length);
+        double peak = 0.0;
+        for( unsigned int n = 0; n < length; n++ ){
+            const double envelope = settings.type == SWEEP_EXPONENTIAL ? std::exp( ((double)n - (double)(length - 1)) / (sampleRate * L) ) : 1.0;
+            filter[length - 1 - n] = (float)(forward[n] * envelope);
+            peak += forward[n] * forward[n] * envelope;        //Zero lag of sweep * filter
+        }
+        if( peak > 0.0 )
+            juce::FloatVectorOperations::multiply( filter.data(), (float)(1.0 / peak), (int)length );
+    }
+
+private:
+    static constexpr unsigned int RENDER_BLOCK_SIZE = 256;
+
+    double fS = 48000.0;
+    sweep_settings_t pendingSettings;
+    std::atomic<bool> startPending { false }, stopPending { false }, finished { true };
+
+    //Audio thread
+    sweep_settings_t settings;
+    bool running = false;
+    juce::int64 sweepFrame = 0;             //Samples since the start of the current sweep
+    juce::int64 sweepLength = 0, fadeLength = 0, periodLength = 0;
+    double expL = 0.0;                      //L, in samples
+    double expA = 0.0;                      //f1.L, in cycles
+    double linearK = 0.0;                   //(f2 - f1) / T, in cycles/sample^2
+    double expTable[RENDER_BLOCK_SIZE];     //e^(m/L) - 1
+    double cycles[RENDER_BLOCK_SIZE];
+    float renderBuffer[RENDER_BLOCK_SIZE];
+    unsigned int renderPosition = RENDER_BLOCK_SIZE;
+
+    void BeginSweep( void )
+    {
+        settings = pendingSettings;
+        sweepLength = std::max<juce::int64>( 1, std::llround( settings.seconds * fS ) );
+        fadeLength = std::min<juce::int64>( std::llround( settings.fadeSeconds * fS ), sweepLength / 2 );
+        periodLength = sweepLength + std::llround( settings.gapSeconds * fS );
+
+        const double f1 = settings.startHz / fS, f2 = settings.endHz / fS;     //cycles/sample
+        if( settings.type == SWEEP_EXPONENTIAL ){
+            expL = (double)sweepLength / std::log( f2 / f1 );
+            expA = f1 * expL;
+            for( unsigned int m = 0; m < RENDER_BLOCK_SIZE; m++ )
+                expTable[m] = std::expm1( (double)m / expL );
+        }else{
+            linearK = (f2 - f1) / (double)sweepLength;
+        }
+
+        sweepFrame = 0;
+        running = true;
+        finished.store(false, std::memory_order_release);
+    }
+
+    void RenderChunk( float* dest, unsigned int numSamples )
+    {
+        if( startPending.exchange(false, std::memory_order_acquire) )
+            BeginSweep();
+        if( stopPending.exchange(false, std::memory_order_acquire) ){
+            running = false;
+            finished.store(true, std::memory_order_release);
+        }
+
+        unsigned int n = 0;
+        while( n < numSamples ){
+            if( !running ){
+                std::fill( dest + n, dest + numSamples, 0.0f );
+                return;
+            }
+
+            if( sweepFrame < sweepLength ){
+                const unsigned int length = (unsigned int)std::min<juce::int64>( numSamples - n, sweepLength - sweepFrame );
+                RenderSweep( dest + n, length );
+                ApplyFades( dest + n, length );
+                sweepFrame += length;
+                n += length;
+            }else if( sweepFrame < periodLength ){
+                const unsigned int length = (unsigned int)std::min<juce::int64>( numSamples - n, periodLength - sweepFrame );
+                std::fill( dest + n, dest + n + length, 0.0f );
+                sweepFrame += length;
+                n += length;
+            }
+
+            if( sweepFrame >= periodLength ){
+                if( settings.repeat ){
+                    sweepFrame = 0;
+                }else{
+                    running = false;
+                    finished.store(true, std::memory_order_release);
+                }
+            }
+        }
+    }
+
+    //Phase in cycles for sweepFrame + m, m < length. The integer part of the block start phase is dropped (exactly)
+    //before the per-sample terms are added, so precision doesn't degrade as the sweep goes on.
+    void RenderSweep( float* dest, unsigned int length )
+    {
+        const double n0 = (double)sweepFrame;
+        if( settings.type == SWEEP_EXPONENTIAL ){
+            const double growth = std::exp( n0 / expL );
+            double c0 = expA * (growth - 1.0);
+            c0 -= std::floor(c0);
+            const double scale = expA * growth;
+            for( unsigned int m = 0; m < length; m++ )
+                cycles[m] = c0 + scale * expTable[m];
+        }else{
+            const double f1 = settings.startHz / fS;
+            double c0 = f1 * n0 + 0.5 * linearK * n0 * n0;
+            c0 -= std::floor(c0);
+            const double a1 = f1 + linearK * n0, a2 = 0.5 * linearK;
+            for( unsigned int m = 0; m < length; m++ ){
+                const double dm = (double)m;
+                cycles[m] = c0 + dm * (a1 + dm * a2);
+            }
+        }
+
+        for( unsigned int m = 0; m < length; m++ ){
+            const float x = (float)(2.0 * (cycles[m] - std::floor(cycles[m])) - 1.0);     //sin(2pi.c) = -sin(pi.x), x in [-1, 1)
+            dest[m] = -SinPi(x);
+        }
+    }
+
+    void ApplyFades( float* dest, unsigned int length )
+    {
+        if( fadeLength == 0 )
+            return;
+
+        const juce::int64 end = sweepFrame + length;
+        for( juce::int64 frame = sweepFrame; frame < std::min( end, fadeLength ); frame++ ){
+            const float s = SinPi( 0.5f * (float)frame / (float)fadeLength );
+            dest[frame - sweepFrame] *= s * s;
+        }
+        for( juce::int64 frame = std::max( sweepFrame, sweepLength - fadeLength ); frame < end; frame++ ){
+            const float s = SinPi( 0.5f * (float)(sweepLength - 1 - frame) / (float)fadeLength );
+            dest[frame - sweepFrame] *= s * s;
+        }
+    }
+};
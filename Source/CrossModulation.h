@@ -0,0 +1,271 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  FM/PM Cross Modulation Between Oscillators.
+ *
+ *  A CrossModulationGroup renders a set of PeriodicOscillators ("operators") a block at a time, where any operator's
+ *  output can modulate any other's phase increment (FM) or phase (PM). A few cheap operators then give rich test and
+ *  synthesis signals (sidebands, noise like spectra, chirps) that would otherwise take dozens of additive partials.
+ *
+ *  - Depths form an operators x operators matrix, edited on any thread and published with Commit() (the audio thread
+ *    picks it up at the next block, as MultitoneGenerator does). FM depth is in Hz per unit of modulator output,
+ *    PM depth in radians per unit. Modulator output includes its amplitude, so SetAmplitude() acts as the index.
+ *  - On Commit the operators are scheduled in dependency order: strongly connected components of the modulation
+ *    graph, in topological order. Acyclic operators are rendered as whole blocks: the modulation inputs are summed
+ *    with vectorised multiply-accumulates, then the operator's RenderModulatedBlock() kernel runs over the block.
+ *  - Feedback loops (including self modulation) are allowed. Routes inside a loop see the modulator's previous sample
+ *    (a single sample delay), so loop members are rendered together a sample at a time; only they pay for it.
+ *  - Every operator is a separate engine source (SigGenEngine::AddModulationGroup), so a pure modulator can be left
+ *    unrouted to the outputs. Don't also add the operators to the engine as voices.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+
+class CrossModulationGroup
+{
+public:
+
+    typedef enum{
+        MODULATION_FM,
+        MODULATION_PM,
+    }modulation_type_t;
+
+    static constexpr unsigned int MAX_OPERATORS = 16;
+
+    CrossModulationGroup(){}
+    ~CrossModulationGroup(){}
+
+    //Setup (before audio starts). Returns the operator index.
+    unsigned int AddOperator( PeriodicOscillator* oscillator )
+    {
+        if( nOperators >= MAX_OPERATORS ){
+            printf("WARNING: CrossModulationGroup Full\r\n");
+            return MAX_OPERATORS;
+        }
+        operators[nOperators] = oscillator;
+        return nOperators++;
+    }
+
+    unsigned int GetNumOperators( void ) const { return nOperators; }
+
+    //Call from prepareToPlay. Allocates the modulation buffers and sets the operators' sample rate.
+    void Prepare( double sampleRate, unsigned int maxBlockSize )
+    {
+        fS = sampleRate;
+        maxBlock = maxBlockSize;
+        for( unsigned int op = 0; op < nOperators; op++ )
+            operators[op]->SetSampleRate( (float)sampleRate );
+        fmBuffer.assign( (size_t)nOperators * maxBlock, 0.0f );
+        pmBuffer.assign( (size_t)nOperators * maxBlock, 0.0f );
+        std::fill( std::begin(lastOutput), std::end(lastOutput), 0.0f );
+        routesPending.store(true, std::memory_order_release);
+    }
+
+    /*
+     *  Routing. These write to the pending matrix, picked up at the next block once Commit() is called.
+     *  Don't edit while a previous Commit() is still pending (IsCommitPending()). depth = 0 removes the route.
+     */
+    void SetModulation( unsigned int modulator, unsigned int carrier, modulation_type_t type, float depth )
+    {
+        if( modulator >= MAX_OPERATORS || carrier >= MAX_OPERATORS )
+            return;
+        (type == MODULATION_FM ? pendingFmDepth : pendingPmDepth)[modulator][carrier] = depth;
+    }
+
+    void ClearModulation( void )
+    {
+        for( unsigned int m = 0; m < MAX_OPERATORS; m++ ){
+            std::fill( std::begin(pendingFmDepth[m]), std::end(pendingFmDepth[m]), 0.0f );
+            std::fill( std::begin(pendingPmDepth[m]), std::end(pendingPmDepth[m]), 0.0f );
+        }
+    }
+
+    void Commit( void ){
+        routesPending.store(true, std::memory_order_release);
+    }
+
+    //True until the audio thread has scheduled the last Commit(). Wait for this before editing again.
+    bool IsCommitPending( void ) const {
+        return routesPending.load(std::memory_order_acquire);
+    }
+
+    /*
+     *  Audio thread. Operator k's output is written to output + k * outputStride.
+     */
+    void RenderBlock( float* output, unsigned int outputStride, unsigned int numSamples )
+    {
+        //Cleared only once Schedule() has read the pending matrices, so IsCommitPending() covers the whole read.
+        if( routesPending.load(std::memory_order_acquire) ){
+            Schedule();
+            routesPending.store(false, std::memory_order_release);
+        }
+
+        for( unsigned int op = 0; op < nOperators; op++ )
+            operators[op]->AdvanceGlide( numSamples );
+
+        for( unsigned int step = 0; step < nSteps; step++ ){
+            const step_t& s = steps[step];
+            for( unsigned int k = 0; k < s.count; k++ ){
+                const unsigned int op = order[s.first + k];
+                SumExternalModulation( op, output, outputStride, numSamples, s.cyclic );
+            }
+
+            if( !s.cyclic ){
+                const unsigned int op = order[s.first];
+                operators[op]->RenderModulatedBlock( output + op * outputStride,
+                                                     hasFm[op] ? FmInput(op) : nullptr,
+                                                     hasPm[op] ? PmInput(op) : nullptr,
+                                                     numSamples );
+            }else{
+                RenderFeedbackLoop( s, output, outputStride, numSamples );
+            }
+        }
+    }
+
+private:
+    typedef struct Step_S{
+        unsigned int first;     //Into order[]
+        unsigned int count;
+        bool cyclic;            //Feedback loop: rendered a sample at a time.
+    }step_t;
+
+    PeriodicOscillator* operators[MAX_OPERATORS] = {};
+    unsigned int nOperators = 0;
+    double fS = 48000.0;
+    unsigned int maxBlock = 0;
+
+    //Pending (edit side) and active (audio side) depth matrices, [modulator][carrier].
+    float pendingFmDepth[MAX_OPERATORS][MAX_OPERATORS] = {};
+    float pendingPmDepth[MAX_OPERATORS][MAX_OPERATORS] = {};
+    float fmScale[MAX_OPERATORS][MAX_OPERATORS] = {};      //radians/sample per unit
+    float pmScale[MAX_OPERATORS][MAX_OPERATORS] = {};
+    std::atomic<bool> routesPending { true };
+
+    //Schedule (audio side, fixed size)
+    unsigned int order[MAX_OPERATORS] = {};
+    step_t steps[MAX_OPERATORS] = {};
+    unsigned int nSteps = 0;
+    unsigned int component[MAX_OPERATORS] = {};
+
+    std::vector<float> fmBuffer, pmBuffer;          //[operator][maxBlock]
+    bool hasFm[MAX_OPERATORS] = {}, hasPm[MAX_OPERATORS] = {};
+    float lastOutput[MAX_OPERATORS] = {};           //Feedback loop state (previous sample)
+
+    float* FmInput( unsigned int op ){ return fmBuffer.data() + (size_t)op * maxBlock; }
+    float* PmInput( unsigned int op ){ return pmBuffer.data() + (size_t)op * maxBlock; }
+
+    /*
+     *  Audio thread, on Commit. Builds the reachability closure (tiny N, so Floyd-Warshall), groups operators into
+     *  strongly connected components and orders the components so every modulator is rendered before its carriers.
+     */
+    void Schedule( void )
+    {
+        const float radiansPerHz = (float)(juce::MathConstants<double>::twoPi / fS);
+        bool reach[MAX_OPERATORS][MAX_OPERATORS];
+        for( unsigned int m = 0; m < nOperators; m++ ){
+            for( unsigned int c = 0; c < nOperators; c++ ){
+                fmScale[m][c] = pendingFmDepth[m][c] * radiansPerHz;
+                pmScale[m][c] = pendingPmDepth[m][c];
+                reach[m][c] = fmScale[m][c] != 0.0f || pmScale[m][c] != 0.0f;
+            }
+        }
+        for( unsigned int k = 0; k < nOperators; k++ )
+            for( unsigned int i = 0; i < nOperators; i++ )
+                if( reach[i][k] )
+                    for( unsigned int j = 0; j < nOperators; j++ )
+                        reach[i][j] |= reach[k][j];
+
+        for( unsigned int i = 0; i < nOperators; i++ ){
+            component[i] = i;
+            for( unsigned int j = 0; j < i; j++ ){
+                if( reach[i][j] && reach[j][i] ){
+                    component[i] = component[j];
+                    break;
+                }
+            }
+        }
+
+        //Emit a component once every modulator outside it has been emitted.
+        bool scheduled[MAX_OPERATORS] = {};
+        unsigned int nScheduled = 0;
+        nSteps = 0;
+        while( nScheduled < nOperators ){
+            for( unsigned int i = 0; i < nOperators; i++ ){
+                if( scheduled[i] || component[i] != i )
+                    continue;
+
+                bool ready = true;
+                for( unsigned int c = 0; c < nOperators && ready; c++ ){
+                    if( component[c] != i )
+                        continue;
+                    for( unsigned int m = 0; m < nOperators && ready; m++ )
+                        ready = component[m] == i || scheduled[m] || ( fmScale[m][c] == 0.0f && pmScale[m][c] == 0.0f );
+                }
+                if( !ready )
+                    continue;
+
+                step_t& step = steps[nSteps++];
+                step.first = nScheduled;
+                step.count = 0;
+                step.cyclic = reach[i][i];
+                for( unsigned int c = 0; c < nOperators; c++ ){
+                    if( component[c] == i ){
+                        order[nScheduled++] = c;
+                        scheduled[c] = true;
+                        step.count++;
+                    }
+                }
+            }
+        }
+    }
+
+    //Sums the modulation from already rendered operators (everything outside this operator's loop) as whole blocks.
+    void SumExternalModulation( unsigned int carrier, const float* output, unsigned int outputStride, unsigned int numSamples, bool cyclic )
+    {
+        hasFm[carrier] = hasPm[carrier] = false;
+        for( unsigned int m = 0; m < nOperators; m++ ){
+            if( cyclic && component[m] == component[carrier] )
+                continue;
+            const float* modulator = output + m * outputStride;
+            if( fmScale[m][carrier] != 0.0f ){
+                if( hasFm[carrier] )
+                    juce::FloatVectorOperations::addWithMultiply( FmInput(carrier), modulator, fmScale[m][carrier], (int)numSamples );
+                else
+                    juce::FloatVectorOperations::copyWithMultiply( FmInput(carrier), modulator, fmScale[m][carrier], (int)numSamples );
+                hasFm[carrier] = true;
+            }
+            if( pmScale[m][carrier] != 0.0f ){
+                if( hasPm[carrier] )
+                    juce::FloatVectorOperations::addWithMultiply( PmInput(carrier), modulator, pmScale[m][carrier], (int)numSamples );
+                else
+                    juce::FloatVectorOperations::copyWithMultiply( PmInput(carrier), modulator, pmScale[m][carrier], (int)numSamples );
+                hasPm[carrier] = true;
+            }
+        }
+    }
+
+    //Loop members see each other's (and their own) previous sample.
+    void RenderFeedbackLoop( const step_t& step, float* output, unsigned int outputStride, unsigned int numSamples )
+    {
+        const unsigned int* members = order + step.first;
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            for( unsigned int k = 0; k < step.count; k++ ){
+                const unsigned int c = members[k];
+                float fm = hasFm[c] ? FmInput(c)[n] : 0.0f;
+                float pm = hasPm[c] ? PmInput(c)[n] : 0.0f;
+                for( unsigned int j = 0; j < step.count; j++ ){
+                    const unsigned int m = members[j];
+                    fm += fmScale[m][c] * lastOutput[m];
+                    pm += pmScale[m][c] * lastOutput[m];
+                }
+                operators[c]->RenderModulatedBlock( output + c * outputStride + n, &fm, &pm, 1 );
+            }
+            for( unsigned int k = 0; k < step.count; k++ )
+                lastOutput[members[k]] = output[members[k] * outputStride + n];
+        }
+    }
+};
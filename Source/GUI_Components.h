@@ -120,6 +120,39 @@ public:
         AudioComponent_periodic = component;    //Add Derived Class Pointer for Periodic Controls.
     }
     
+    //Remote control (e.g. MIDI CC), message thread. Moves the controls, so the audio component is set exactly as if they had been used.
+    void SetLevelNormalised( float normalised ){
+        levelSlider.setValue( config.level_slider_range.min + (config.level_slider_range.max - config.level_slider_range.min) * normalised, juce::sendNotificationSync );
+    }
+    
+    void SetMuted( bool muted ){
+        if( noiseActiveButton.getToggleState() == !muted )
+            return;         //Muting twice would lose the unmuted level.
+        noiseActiveButton.setToggleState( !muted, juce::dontSendNotification );
+        noiseActiveButtonClicked();
+    }
+    
+    //After something else has set the audio component (e.g. a scene recall): show its state, without writing it back.
+    void RefreshFromAudioComponent( void ){
+        if( !AudioComponent )
+            return;
+        levelSlider.setValue( AudioComponent->GetAmplitude(), juce::dontSendNotification );
+        noiseActiveButton.setToggleState( !AudioComponent->IsMuted(), juce::dontSendNotification );
+        ShowActiveState( !AudioComponent->IsMuted() );
+        
+        if( !AudioComponent_periodic )
+            return;
+        const float freq = AudioComponent_periodic->GetFrequency();
+        if( syncSettings.isSynced && !syncSettings.isSyncTalker ){
+            const float talkerFreq = GetSyncGroupTalkerFrequency();     //Talkers come first, so already refreshed.
+            if( talkerFreq > 0.0f )
+                frequencySlider.setValue( freq / talkerFreq, juce::dontSendNotification );
+            frequencyLabel.setText("F: " + std::to_string(freq), juce::dontSendNotification);
+        }else{
+            frequencySlider.setValue( freq, juce::dontSendNotification );
+        }
+    }
+    
     //Set The Sync State of the GUI. i.e. Is this SigGen Synced to the f0 of it's voice group.
     
     //configures this instance as the Sync Talker for it's sync group
@@ -142,6 +175,7 @@ public:
     
     /*
      * For a given sync group, set the talker frequency and update all listeners.
+     * With a glide time set, the talker glides to freq and every listener glides with it (see SetSyncListenerFrequencyRelativeToGroupTalker).
      */
     void SetSyncGroupTalkerFrequency( float freq )
     {
@@ -176,6 +210,7 @@ public:
         }
 
         const float freq = GetSyncGroupTalkerFrequency() * frequencySlider.getValue();//When configured as listener, freqSlider is relative to talker freq.
+        AudioComponent_periodic->SetGlideTime( GetSyncGroupTalkerGlideTime() );    //Same glide time as the talker, so the ratio holds throughout its glide.
         AudioComponent_periodic->SetFrequency(freq);
         
         frequencyLabel.setText("F: " + std::to_string(freq), juce::dontSendNotification);
@@ -194,6 +229,18 @@ public:
         }
         return freq;
     }
+    
+    float GetSyncGroupTalkerGlideTime( void )
+    {
+        for( unsigned int i = 0; i < GetObjectInstanceCount(); i++ ){
+            if(( GetObjectFromList(i)->syncSettings.syncGroup == syncSettings.syncGroup ) &&    //matching syncGroup
+               ( GetObjectFromList(i)->syncSettings.isSyncTalker == true) &&                    //isCurrently Talker
+               ( GetObjectFromList(i)->AudioComponent_periodic != nullptr ) ){
+                return GetObjectFromList(i)->AudioComponent_periodic->GetGlideTime();
+            }
+        }
+        return AudioComponent_periodic ? AudioComponent_periodic->GetGlideTime() : 0.0f;
+    }
         
     void SetSyncState( bool isTalker, bool isSynced )
     {
@@ -287,19 +334,23 @@ private:
     //Mouse Click Behaviour Handling...
     void noiseActiveButtonClicked( void )
     {
-        if( noiseActiveButton.getToggleStateValue() == true ){
+        const bool active = noiseActiveButton.getToggleStateValue() == true;
+        ShowActiveState( active );
+        if(AudioComponent)
+            AudioComponent->Mute(!active);
+        else
+            printf("WARNING: Audio Component Not Attached to GUI\r\n");
+    }
+    
+    void ShowActiveState( bool active )
+    {
+        if( active ){
             noiseActiveButton.setButtonText("Active");
             noiseActiveButton.setColour(juce::TextButton::ColourIds::buttonOnColourId, juce::Colours::limegreen);
-            if(AudioComponent)
-                AudioComponent->Mute(false);
         }else{
             noiseActiveButton.setButtonText("Muted");
             noiseActiveButton.setColour(juce::TextButton::ColourIds::buttonColourId, juce::Colours::red);
-            if(AudioComponent)
-                AudioComponent->Mute(true);
         }
-        if(AudioComponent == NULL)
-            printf("WARNING: Audio Component Not Attached to GUI\r\n");
     }
     
     void AddLabels( void )
@@ -532,6 +583,33 @@ public:
         sigGenVoiceGUI[Gui_index].AttachAudioComponent_Periodic( AudioComponent );
     }
     
+    /*
+     *  Remote control of a voice GUI (message thread). normalised is 0..1 across its level slider range.
+     */
+    void SetVoiceLevelNormalised( const unsigned int Gui_index, float normalised ){
+        if( Gui_index < N_SIG_GEN_VOICE_GUIS )
+            sigGenVoiceGUI[Gui_index].SetLevelNormalised( normalised );
+    }
+    
+    void SetVoiceMuted( const unsigned int Gui_index, bool muted ){
+        if( Gui_index < N_SIG_GEN_VOICE_GUIS )
+            sigGenVoiceGUI[Gui_index].SetMuted( muted );
+    }
+    
+    /*
+     *  While something else owns the audio components (e.g. a scene switch), the controls are disabled so they can't
+     *  write to them. Refresh them from the audio components before enabling them again.
+     */
+    void SetVoiceControlsEnabled( bool enabled ){
+        for( auto& voiceGUI : sigGenVoiceGUI )
+            voiceGUI.setEnabled( enabled );
+    }
+    
+    void RefreshVoiceControls( void ){
+        for( auto& voiceGUI : sigGenVoiceGUI )
+            voiceGUI.RefreshFromAudioComponent();
+    }
+    
     /*
      *  Mouse Move Used to return Co-ords to ease GUI layout.
      */
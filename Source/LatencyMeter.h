@@ -0,0 +1,444 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Round Trip Latency and Dropout Measurement.
+ *
+ *  A periodic Maximum Length Sequence (MLS) is written to the outputs and the captured input is analysed on a worker
+ *  thread. Loop an output back to input 0 (cable, or a software loopback device) and:
+ *
+ *  1) Latency: once per MLS period the captured period is cross-correlated (FFT) with the sequence. The correlation of
+ *     an MLS is a single spike, so the peak gives the round trip latency to the sample (modulo the period, which is
+ *     2^order - 1 samples: ~1.4s at 48K for the default order).
+ *  2) Dropouts/Glitches: the stimulus is periodic, so (for any LTI loopback path) the captured signal is too. Every
+ *     chunk is compared with the last clean capture of the same position in the period. Any dropout, repeated/lost
+ *     buffer or click leaves a residual, and is counted with its time. No knowledge of the loopback response is needed.
+ *     A position that mismatches twice in the same way means the reference was stale (e.g. the latency moved), so it's
+ *     relearnt rather than flagged every period.
+ *
+ *  Audio thread: CaptureInput() then WriteStimulus(), once per block. No locks, no allocation. The captured input goes
+ *  through a single producer / single consumer ring indexed by absolute frame (as in SharedMemoryOutput.h); if the
+ *  worker is lapped it resyncs and counts an overrun rather than reporting a false glitch.
+ *
+ *  NOTE: Requires the juce_dsp module (juce::dsp::FFT).
+ *
+ *  READING:
+ *  1) Rife & Vanderkooy, "Transfer-Function Measurement with Maximum-Length Sequences", JAES 1989
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "stdio.h"
+
+class LatencyMeter : private juce::Thread
+{
+public:
+
+    typedef struct LatencyReport_S{
+        int latencySamples;             //-1 until the loopback is found
+        double latencyMs;
+        float peakToNoiseDb;            //Correlation peak vs the rest. ~40dB+ for a clean loopback.
+        bool inverted;                  //Loopback path inverts polarity
+        bool signalPresent;             //Anything arriving at the input at all
+        unsigned int measurements;      //Latency measurements (one per MLS period)
+        unsigned int glitches;
+        unsigned int latencyChanges;    //Latency moved between measurements (e.g. a lost buffer the driver didn't recover)
+        unsigned int overruns;          //Analysis fell behind and skipped ahead
+        double lastGlitchSeconds;       //Since Start(), -1 if none
+    }latency_report_t;
+
+    static constexpr unsigned int MIN_MLS_ORDER = 10;
+    static constexpr unsigned int MAX_MLS_ORDER = 18;
+    static constexpr unsigned int DEFAULT_MLS_ORDER = 16;       //65535 samples
+
+    LatencyMeter() : juce::Thread("Latency Meter") {}
+    ~LatencyMeter() override { Stop(); }
+
+    //Allocates. Call while the audio callback isn't running (e.g. from prepareToPlay), and while stopped.
+    bool Prepare( double sampleRate, unsigned int mlsOrder = DEFAULT_MLS_ORDER, float level = 0.1f )
+    {
+        if( mlsOrder < MIN_MLS_ORDER || mlsOrder > MAX_MLS_ORDER ){
+            printf("WARNING: MLS order %u out of range\r\n", mlsOrder);
+            return false;
+        }
+        Stop();
+
+        fS = sampleRate;
+        period = (1u << mlsOrder) - 1;
+        mls.resize(period);
+        GenerateMls(mlsOrder, level);
+
+        //Correlation: the captured period (zero padded) against two periods of the sequence, so lags 0..period-1 don't wrap.
+        fft.reset( new juce::dsp::FFT( (int)mlsOrder + 1 ) );
+        fftSize = 1u << (mlsOrder + 1);
+        sequenceSpectrum.assign(fftSize * 2, 0.0f);
+        for( unsigned int n = 0; n < fftSize; n++ )
+            sequenceSpectrum[n] = mls[n % period];
+        fft->performRealOnlyForwardTransform(sequenceSpectrum.data());
+        correlation.assign(fftSize * 2, 0.0f);
+
+        ringSize = (unsigned int)juce::nextPowerOfTwo( (int)period * 4 );
+        ring.assign(ringSize, 0.0f);
+        window.assign(period, 0.0f);
+        reference.assign(period, 0.0f);
+        candidate.assign(period, 0.0f);
+        chunk.assign(ANALYSIS_CHUNK, 0.0f);
+        return true;
+    }
+
+    void SetGlitchThresholdDb( float db ){ glitchThreshold = std::pow( 10.0f, db / 10.0f ); }    //Residual energy vs signal. Default -10dB.
+
+    bool Start( void )
+    {
+        if( period == 0 ){
+            printf("WARNING: LatencyMeter Not Prepared\r\n");
+            return false;
+        }
+        Stop();
+        ResetAnalysis();
+        ResetReport();
+        requestedRun.fetch_add(1, std::memory_order_acq_rel);
+        running.store(true, std::memory_order_release);
+        startThread();
+        return true;
+    }
+
+    void Stop( void )
+    {
+        running.store(false, std::memory_order_release);
+        stopThread(1000);
+    }
+
+    bool IsRunning( void ) const { return running.load(std::memory_order_acquire); }
+
+    latency_report_t GetReport( void ) const
+    {
+        latency_report_t report;
+        report.latencySamples = latencySamples.load(std::memory_order_relaxed);
+        report.latencyMs = report.latencySamples >= 0 ? 1000.0 * report.latencySamples / fS : -1.0;
+        report.peakToNoiseDb = peakToNoiseDb.load(std::memory_order_relaxed);
+        report.inverted = inverted.load(std::memory_order_relaxed);
+        report.signalPresent = signalPresent.load(std::memory_order_relaxed);
+        report.measurements = measurements.load(std::memory_order_relaxed);
+        report.glitches = glitches.load(std::memory_order_relaxed);
+        report.latencyChanges = latencyChanges.load(std::memory_order_relaxed);
+        report.overruns = overruns.load(std::memory_order_relaxed);
+        const int64_t glitchFrame = lastGlitchFrame.load(std::memory_order_relaxed);
+        report.lastGlitchSeconds = glitchFrame >= 0 ? (double)glitchFrame / fS : -1.0;
+        return report;
+    }
+
+    //==========================================================================
+    //Audio thread. Call before anything writes the output (JUCE shares the input and output buffers).
+    //Returns true if measuring, in which case WriteStimulus() must be called for the same block.
+    bool CaptureInput( const float* input, unsigned int numSamples )
+    {
+        blockActive = running.load(std::memory_order_acquire);
+        if( !blockActive )
+            return false;
+
+        const uint32_t run = requestedRun.load(std::memory_order_acquire);
+        if( run != audioRun ){          //First block of a new run: input and output frame counts restart together.
+            audioRun = run;
+            audioFrame = 0;
+            stimulusIndex = 0;
+            writeFrame.store(0, std::memory_order_release);
+            acknowledgedRun.store(run, std::memory_order_release);
+        }
+
+        const unsigned int mask = ringSize - 1;
+        for( unsigned int n = 0; n < numSamples; ){
+            const unsigned int position = (unsigned int)(audioFrame & mask);
+            const unsigned int length = std::min( numSamples - n, ringSize - position );
+            if( input != nullptr )
+                std::copy( input + n, input + n + length, ring.data() + position );
+            else
+                std::fill( ring.data() + position, ring.data() + position + length, 0.0f );
+            audioFrame += length;
+            n += length;
+        }
+        writeFrame.store(audioFrame, std::memory_order_release);
+        return true;
+    }
+
+    //Audio thread. Replaces the block on every channel with the stimulus (a periodic, uninterrupted sequence is required).
+    void WriteStimulus( float* const* channels, unsigned int numChannels, unsigned int startSample, unsigned int numSamples )
+    {
+        if( !blockActive || numChannels == 0 )
+            return;
+
+        float* first = channels[0] + startSample;
+        for( unsigned int n = 0; n < numSamples; ){
+            const unsigned int length = std::min( numSamples - n, period - stimulusIndex );
+            std::copy( mls.data() + stimulusIndex, mls.data() + stimulusIndex + length, first + n );
+            stimulusIndex = (stimulusIndex + length) % period;
+            n += length;
+        }
+        for( unsigned int channel = 1; channel < numChannels; channel++ )
+            juce::FloatVectorOperations::copy( channels[channel] + startSample, first, (int)numSamples );
+    }
+
+private:
+    static constexpr unsigned int ANALYSIS_CHUNK = 1024;        //Glitch time resolution (~21ms @ 48K)
+    static constexpr float LOCK_THRESHOLD_DB = 20.0f;
+    static constexpr float SILENCE_THRESHOLD = 1e-8f;           //Mean square per sample
+
+    double fS = 48000.0;
+    unsigned int period = 0;
+    std::vector<float> mls;
+
+    //Audio -> worker ring
+    std::vector<float> ring;
+    unsigned int ringSize = 0;
+    std::atomic<uint64_t> writeFrame { 0 };
+    std::atomic<bool> running { false };
+    std::atomic<uint32_t> requestedRun { 0 }, acknowledgedRun { 0 };
+
+    //Audio thread only
+    bool blockActive = false;
+    uint32_t audioRun = 0;
+    uint64_t audioFrame = 0;
+    unsigned int stimulusIndex = 0;
+
+    //Worker only
+    std::unique_ptr<juce::dsp::FFT> fft;
+    unsigned int fftSize = 0;
+    std::vector<float> sequenceSpectrum, correlation;
+    std::vector<float> window, reference, candidate, chunk;
+    uint64_t readFrame = 0, windowStartFrame = 0;
+    unsigned int windowFill = 0;
+    unsigned int referenceFill = 0;         //Reference is usable once a whole period is in
+    unsigned int consecutiveGlitchChunks = 0;
+    float glitchThreshold = 0.1f;
+
+    //Published
+    std::atomic<int> latencySamples { -1 };
+    std::atomic<float> peakToNoiseDb { 0.0f };
+    std::atomic<bool> inverted { false }, signalPresent { false };
+    std::atomic<unsigned int> measurements { 0 }, glitches { 0 }, latencyChanges { 0 }, overruns { 0 };
+    std::atomic<int64_t> lastGlitchFrame { -1 };
+
+    //Galois LFSR feedback masks (maximal length), indexed by order.
+    void GenerateMls( unsigned int order, float level )
+    {
+        static const uint32_t TAPS[MAX_MLS_ORDER + 1] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            (1u << 9) | (1u << 6),                                  //10
+            (1u << 10) | (1u << 8),                                 //11
+            (1u << 11) | (1u << 5) | (1u << 3) | (1u << 0),         //12
+            (1u << 12) | (1u << 3) | (1u << 2) | (1u << 0),         //13
+            (1u << 13) | (1u << 4) | (1u << 2) | (1u << 0),         //14
+            (1u << 14) | (1u << 13),                                //15
+            (1u << 15) | (1u << 14) | (1u << 12) | (1u << 3),       //16
+            (1u << 16) | (1u << 13),                                //17
+            (1u << 17) | (1u << 10),                                //18
+        };
+
+        uint32_t state = 1;
+        for( unsigned int n = 0; n < period; n++ ){
+            mls[n] = (state & 1u) ? level : -level;
+            state = (state >> 1) ^ ( (state & 1u) ? TAPS[order] : 0u );
+        }
+    }
+
+    void ResetAnalysis( void )
+    {
+        readFrame = 0;
+        windowStartFrame = 0;
+        windowFill = 0;
+        referenceFill = 0;
+        consecutiveGlitchChunks = 0;
+    }
+
+    void ResetReport( void )
+    {
+        latencySamples.store(-1);
+        peakToNoiseDb.store(0.0f);
+        inverted.store(false);
+        signalPresent.store(false);
+        measurements.store(0);
+        glitches.store(0);
+        latencyChanges.store(0);
+        overruns.store(0);
+        lastGlitchFrame.store(-1);
+    }
+
+    void run() override
+    {
+        //Wait for the audio thread to pick up this run, so both ends agree on frame 0.
+        const uint32_t run = requestedRun.load(std::memory_order_acquire);
+        while( acknowledgedRun.load(std::memory_order_acquire) != run ){
+            if( threadShouldExit() )
+                return;
+            wait(5);
+        }
+
+        const unsigned int mask = ringSize - 1;
+        while( !threadShouldExit() ){
+            const uint64_t written = writeFrame.load(std::memory_order_acquire);
+            if( written - readFrame > ringSize - ANALYSIS_CHUNK ){
+                Resync(written);
+                continue;
+            }
+            if( written - readFrame < ANALYSIS_CHUNK ){
+                wait(5);
+                continue;
+            }
+
+            const unsigned int position = (unsigned int)(readFrame & mask);
+            const unsigned int firstLength = std::min( ANALYSIS_CHUNK, ringSize - position );
+            std::copy( ring.data() + position, ring.data() + position + firstLength, chunk.data() );
+            std::copy( ring.data(), ring.data() + (ANALYSIS_CHUNK - firstLength), chunk.data() + firstLength );
+
+            //Lapped while copying? (seqlock style, as SharedMemoryOutputReader::Validate)
+            if( writeFrame.load(std::memory_order_acquire) - readFrame > ringSize ){
+                Resync( writeFrame.load(std::memory_order_acquire) );
+                continue;
+            }
+
+            DetectGlitches(readFrame);
+            AccumulateWindow(readFrame);
+            readFrame += ANALYSIS_CHUNK;
+        }
+    }
+
+    void Resync( uint64_t written )
+    {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t frame = readFrame;
+        ResetAnalysis();
+        readFrame = std::max( frame, written );
+        windowStartFrame = readFrame;
+    }
+
+    //Compare the chunk with the last clean capture at the same point in the period.
+    void DetectGlitches( uint64_t startFrame )
+    {
+        const unsigned int phase = (unsigned int)(startFrame % period);
+        const unsigned int firstLength = std::min( ANALYSIS_CHUNK, period - phase );
+
+        double chunkEnergy = 0.0;
+        for( unsigned int n = 0; n < ANALYSIS_CHUNK; n++ )
+            chunkEnergy += chunk[n] * chunk[n];
+        const bool present = chunkEnergy > SILENCE_THRESHOLD * ANALYSIS_CHUNK;
+        signalPresent.store(present, std::memory_order_relaxed);
+
+        //Only learn once the loopback has been found, so the reference doesn't include the start up silence.
+        if( latencySamples.load(std::memory_order_relaxed) < 0 ){
+            referenceFill = 0;
+            return;
+        }
+        if( referenceFill < period ){
+            StoreChunk(reference, phase, firstLength);
+            referenceFill += ANALYSIS_CHUNK;
+            return;
+        }
+
+        double referenceEnergy;
+        const double residual = Residual(reference, phase, firstLength, referenceEnergy);
+        if( residual <= glitchThreshold * referenceEnergy && referenceEnergy > 0.0 ){
+            consecutiveGlitchChunks = 0;
+            StoreChunk(reference, phase, firstLength);      //Tracks slow drift in the loopback path.
+            return;
+        }
+
+        //Mismatch. If this position looks the same as it did last period, it was the reference that was wrong
+        //(a glitch while learning, or the latency moved): take the new capture and carry on.
+        if( present ){
+            double candidateEnergy;
+            if( Residual(candidate, phase, firstLength, candidateEnergy) <= glitchThreshold * chunkEnergy ){
+                consecutiveGlitchChunks = 0;
+                StoreChunk(reference, phase, firstLength);
+                return;
+            }
+            StoreChunk(candidate, phase, firstLength);
+        }
+
+        if( consecutiveGlitchChunks++ == 0 ){       //One glitch per disturbance, not per chunk.
+            glitches.fetch_add(1, std::memory_order_relaxed);
+            lastGlitchFrame.store((int64_t)startFrame, std::memory_order_relaxed);
+        }
+    }
+
+    double Residual( const std::vector<float>& previous, unsigned int phase, unsigned int firstLength, double& previousEnergy ) const
+    {
+        double residual = 0.0;
+        previousEnergy = 0.0;
+        for( unsigned int n = 0; n < ANALYSIS_CHUNK; n++ ){
+            const float value = n < firstLength ? previous[phase + n] : previous[n - firstLength];
+            const float difference = chunk[n] - value;
+            residual += difference * difference;
+            previousEnergy += value * value;
+        }
+        return residual;
+    }
+
+    void StoreChunk( std::vector<float>& destination, unsigned int phase, unsigned int firstLength )
+    {
+        std::copy( chunk.begin(), chunk.begin() + firstLength, destination.begin() + phase );
+        std::copy( chunk.begin() + firstLength, chunk.end(), destination.begin() );
+    }
+
+    void AccumulateWindow( uint64_t startFrame )
+    {
+        unsigned int n = 0;
+        while( n < ANALYSIS_CHUNK ){
+            if( windowFill == 0 )
+                windowStartFrame = startFrame + n;
+            const unsigned int length = std::min( ANALYSIS_CHUNK - n, period - windowFill );
+            std::copy( chunk.begin() + n, chunk.begin() + n + length, window.begin() + windowFill );
+            windowFill += length;
+            n += length;
+            if( windowFill == period ){
+                MeasureLatency(windowStartFrame);
+                windowFill = 0;
+            }
+        }
+    }
+
+    //Circular cross-correlation of one captured period with the sequence.
+    //Input frame t holds the output from frame t - latency, so the peak lag l satisfies: latency = (t0 - l) mod period.
+    void MeasureLatency( uint64_t t0 )
+    {
+        std::fill( correlation.begin(), correlation.end(), 0.0f );
+        std::copy( window.begin(), window.end(), correlation.begin() );
+        fft->performRealOnlyForwardTransform(correlation.data());
+
+        for( unsigned int k = 0; k <= fftSize / 2; k++ ){       //conj(X) * S
+            const float xRe = correlation[2 * k], xIm = correlation[2 * k + 1];
+            const float sRe = sequenceSpectrum[2 * k], sIm = sequenceSpectrum[2 * k + 1];
+            correlation[2 * k]     = xRe * sRe + xIm * sIm;
+            correlation[2 * k + 1] = xRe * sIm - xIm * sRe;
+        }
+        fft->performRealOnlyInverseTransform(correlation.data());
+
+        unsigned int peakLag = 0;
+        float peak = 0.0f;
+        double sumSquares = 0.0;
+        for( unsigned int lag = 0; lag < period; lag++ ){
+            const float value = std::abs(correlation[lag]);
+            sumSquares += (double)value * value;
+            if( value > peak ){
+                peak = value;
+                peakLag = lag;
+            }
+        }
+
+        const double rms = std::sqrt( sumSquares / period );
+        const float pnr = rms > 0.0 ? (float)(20.0 * std::log10( peak / rms )) : 0.0f;
+        peakToNoiseDb.store(pnr, std::memory_order_relaxed);
+        measurements.fetch_add(1, std::memory_order_relaxed);
+
+        if( pnr < LOCK_THRESHOLD_DB ){
+            latencySamples.store(-1, std::memory_order_relaxed);
+            return;
+        }
+
+        const int latency = (int)(( t0 % period + period - peakLag ) % period);
+        const int previous = latencySamples.exchange(latency, std::memory_order_relaxed);
+        inverted.store(correlation[peakLag] < 0.0f, std::memory_order_relaxed);
+        if( previous >= 0 && previous != latency )
+            latencyChanges.fetch_add(1, std::memory_order_relaxed);
+    }
+};
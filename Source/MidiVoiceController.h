@@ -0,0 +1,345 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  MIDI Control of SigGen Voices.
+ *
+ *  - Note on/off allocate/release voices from a preallocated pool of PeriodicOscillators (frequency from the note,
+ *    amplitude from the velocity). Allocation, release and stealing (oldest voice first) are all O(1).
+ *  - Pitch bend retunes every sounding pool voice. CC 120/123 release everything.
+ *  - Any CC can be mapped to the frequency, amplitude or mute of any generator. Mapped CCs are applied on the audio
+ *    thread, so only map generators nothing else writes to.
+ *  - CCs for generators that another thread also controls (e.g. GUI voices) can be watched instead: the latest value
+ *    is latched in an atomic and collected with TakeControllerValue() by that thread, which applies it as its own edit.
+ *
+ *  Timing: MIDI callbacks push timestamped events into a lock free FIFO. At the start of each audio block the events
+ *  that arrived during the previous block are placed at the same relative sample offset in this one, and SigGenEngine
+ *  splits the render at those offsets. That's a constant one block of latency with sub-sample jitter (relative to the
+ *  callback), rather than everything snapping to the block boundary.
+ *
+ *  Nothing on the audio thread allocates or locks. The producer side is guarded by a SpinLock only so that several
+ *  MIDI devices (possibly on different threads) can feed the same FIFO.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+#include "SigGenEngine.h"
+#include "stdio.h"
+
+class MidiVoiceController : public juce::MidiInputCallback,
+                            public SigGenEventProcessor
+{
+public:
+
+    typedef enum{
+        CC_TARGET_FREQUENCY,        //Exponential between min and max (Hz)
+        CC_TARGET_AMPLITUDE,        //Linear between min and max
+        CC_TARGET_MUTE,             //Muted when value >= 64
+    }cc_target_t;
+
+    static constexpr unsigned int MAX_POOL_VOICES = 64;
+    static constexpr unsigned int MAX_CC_MAPPINGS = 32;
+    static constexpr int NO_CONTROLLER_VALUE = -1;
+
+    MidiVoiceController()
+    {
+        std::fill( std::begin(noteToVoice), std::end(noteToVoice), -1 );
+        std::fill( std::begin(watchedControllers), std::end(watchedControllers), false );
+        for( auto& value : controllerValues )
+            value.store( NO_CONTROLLER_VALUE, std::memory_order_relaxed );
+    }
+    ~MidiVoiceController() override {}
+
+    //Setup (before audio starts). The voices should also be registered with the engine as normal.
+    bool AddPoolVoice( PeriodicOscillator* voice )
+    {
+        if( nPoolVoices >= MAX_POOL_VOICES )
+            return false;
+        pool[nPoolVoices].osc = voice;
+        voice->Mute(true);
+        freeVoices[nFreeVoices++] = (int)nPoolVoices;
+        nPoolVoices++;
+        return true;
+    }
+
+    //Setup (before audio starts). Frequency targets must be PeriodicOscillators, with a positive min and max.
+    bool MapController( int controller, SigGen* generator, cc_target_t target, float min, float max )
+    {
+        if( nControllerMaps >= MAX_CC_MAPPINGS || generator == nullptr )
+            return false;
+        PeriodicOscillator* periodic = dynamic_cast<PeriodicOscillator*>(generator);
+        if( target == CC_TARGET_FREQUENCY && periodic == nullptr )
+            return false;
+        if( target == CC_TARGET_FREQUENCY && !(min > 0.0f && max > 0.0f) ){
+            printf("WARNING: CC %d frequency range must be positive (%f - %f Hz)\r\n", controller, min, max);
+            return false;
+        }
+        controllerMaps[nControllerMaps++] = { controller, generator, periodic, target, min, max };
+        return true;
+    }
+
+    //Setup (before MIDI starts). The controller's values are latched for TakeControllerValue() rather than sent to the audio thread.
+    bool WatchController( int controller )
+    {
+        if( controller < 0 || controller > 127 )
+            return false;
+        watchedControllers[controller] = true;
+        return true;
+    }
+
+    //Any thread. The latest value (0..127) of a watched controller since the last call, or NO_CONTROLLER_VALUE.
+    int TakeControllerValue( int controller )
+    {
+        if( controller < 0 || controller > 127 )
+            return NO_CONTROLLER_VALUE;
+        return controllerValues[controller].exchange( NO_CONTROLLER_VALUE, std::memory_order_relaxed );
+    }
+
+    void SetSampleRate( double rate ){ sampleRate = rate; }
+    void SetVelocityLevel( float level ){ velocityLevel = level; }          //Amplitude at velocity 127
+    void SetPitchBendRange( float semitones ){ pitchBendRange = semitones; }
+
+    //MIDI thread(s).
+    void handleIncomingMidiMessage( juce::MidiInput*, const juce::MidiMessage& message ) override
+    {
+        PostMessage( message, message.getTimeStamp() );
+    }
+
+    //Any non-audio thread. timeSeconds uses the same clock as MidiInput: juce::Time::getMillisecondCounterHiRes() * 0.001
+    void PostMessage( const juce::MidiMessage& message, double timeSeconds )
+    {
+        if( message.getRawDataSize() > 3 )      //SysEx etc. aren't used.
+            return;
+
+        midi_event_t event;
+        event.timeSeconds = timeSeconds;
+        event.offset = 0;
+        const juce::uint8* raw = message.getRawData();
+        event.status = raw[0];
+        event.data1 = message.getRawDataSize() > 1 ? raw[1] : 0;
+        event.data2 = message.getRawDataSize() > 2 ? raw[2] : 0;
+
+        if( (event.status & 0xF0) == 0xB0 && watchedControllers[event.data1 & 0x7F] ){
+            controllerValues[event.data1 & 0x7F].store( event.data2 & 0x7F, std::memory_order_relaxed );
+            return;
+        }
+
+        const juce::SpinLock::ScopedLockType lock(producerLock);
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite( 1, start1, size1, start2, size2 );
+        if( size1 > 0 )
+            fifoEvents[start1] = event;
+        else if( size2 > 0 )
+            fifoEvents[start2] = event;
+        fifo.finishedWrite( size1 + size2 );        //Full FIFO: the event is dropped.
+    }
+
+    //==========================================================================
+    //Audio thread (SigGenEventProcessor)
+    void BeginBlock( unsigned int numSamples ) override
+    {
+        const double now = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        const double windowStart = now - (double)numSamples / sampleRate;     //i.e. the previous block
+
+        nBlockEvents = 0;
+        blockEventIndex = 0;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead( std::min( fifo.getNumReady(), (int)MAX_EVENTS_PER_BLOCK ), start1, size1, start2, size2 );
+        for( int i = 0; i < size1 + size2; i++ ){
+            midi_event_t event = fifoEvents[ i < size1 ? start1 + i : start2 + (i - size1) ];
+            const double offset = (event.timeSeconds - windowStart) * sampleRate;
+            event.offset = (unsigned int)juce::jlimit( 0.0, (double)(numSamples - 1), offset );
+
+            //MIDI arrival order is time order, but clamping can't be allowed to reorder anything.
+            if( nBlockEvents > 0 )
+                event.offset = std::max( event.offset, blockEvents[nBlockEvents - 1].offset );
+            blockEvents[nBlockEvents++] = event;
+        }
+        fifo.finishedRead( size1 + size2 );
+    }
+
+    unsigned int ApplyEventsAt( unsigned int sampleOffset ) override
+    {
+        while( blockEventIndex < nBlockEvents && blockEvents[blockEventIndex].offset <= sampleOffset )
+            ApplyEvent( blockEvents[blockEventIndex++] );
+
+        return blockEventIndex < nBlockEvents ? blockEvents[blockEventIndex].offset : std::numeric_limits<unsigned int>::max();
+    }
+
+private:
+    static constexpr int FIFO_SIZE = 1024;
+    static constexpr unsigned int MAX_EVENTS_PER_BLOCK = 512;
+
+    typedef struct MidiEvent_S{
+        double timeSeconds;
+        unsigned int offset;        //Sample offset within the current block (audio thread only)
+        juce::uint8 status, data1, data2;
+    }midi_event_t;
+
+    typedef struct PoolVoice_S{
+        PeriodicOscillator* osc = nullptr;
+        int note = -1;
+        int older = -1, newer = -1;     //Active list, oldest first. Lets the oldest voice be stolen in O(1).
+    }pool_voice_t;
+
+    typedef struct ControllerMap_S{
+        int controller;
+        SigGen* generator;
+        PeriodicOscillator* periodic;
+        cc_target_t target;
+        float min, max;
+    }controller_map_t;
+
+    //FIFO (MIDI threads -> audio thread)
+    juce::AbstractFifo fifo { FIFO_SIZE };
+    midi_event_t fifoEvents[FIFO_SIZE];
+    juce::SpinLock producerLock;
+
+    //Audio thread state
+    midi_event_t blockEvents[MAX_EVENTS_PER_BLOCK];
+    unsigned int nBlockEvents = 0, blockEventIndex = 0;
+    double sampleRate = 48000.0;
+    float velocityLevel = 0.25f;
+    float pitchBendRange = 2.0f;
+    float pitchBendRatio = 1.0f;
+
+    //Voice pool
+    pool_voice_t pool[MAX_POOL_VOICES];
+    unsigned int nPoolVoices = 0;
+    int freeVoices[MAX_POOL_VOICES];        //Stack
+    unsigned int nFreeVoices = 0;
+    int oldestActive = -1, newestActive = -1;
+    int noteToVoice[128];
+
+    controller_map_t controllerMaps[MAX_CC_MAPPINGS];
+    unsigned int nControllerMaps = 0;
+
+    //Watched controllers (MIDI threads -> whoever collects them)
+    bool watchedControllers[128];
+    std::atomic<int> controllerValues[128];
+
+    static float NoteToFrequency( int note ){ return 440.0f * std::pow( 2.0f, (float)(note - 69) / 12.0f ); }
+
+    void ApplyEvent( const midi_event_t& event )
+    {
+        const int type = event.status & 0xF0;
+        switch( type ){
+            case 0x90:
+                if( event.data2 > 0 ){
+                    NoteOn( event.data1 & 0x7F, event.data2 );
+                    break;
+                }
+                NoteOff( event.data1 & 0x7F );      //Note on with velocity 0 is a note off.
+                break;
+            case 0x80:
+                NoteOff( event.data1 & 0x7F );
+                break;
+            case 0xE0:
+                PitchBend( ((int)event.data2 << 7) | event.data1 );
+                break;
+            case 0xB0:
+                Controller( event.data1, event.data2 );
+                break;
+            default: break;
+        }
+    }
+
+    //Active list (doubly linked, oldest first)
+    void LinkNewest( int v )
+    {
+        pool[v].older = newestActive;
+        pool[v].newer = -1;
+        if( newestActive >= 0 ) pool[newestActive].newer = v;
+        newestActive = v;
+        if( oldestActive < 0 ) oldestActive = v;
+    }
+
+    void Unlink( int v )
+    {
+        if( pool[v].older >= 0 ) pool[pool[v].older].newer = pool[v].newer;
+        else                     oldestActive = pool[v].newer;
+        if( pool[v].newer >= 0 ) pool[pool[v].newer].older = pool[v].older;
+        else                     newestActive = pool[v].older;
+        pool[v].older = pool[v].newer = -1;
+    }
+
+    void NoteOn( int note, int velocity )
+    {
+        if( nPoolVoices == 0 )
+            return;
+
+        int v = noteToVoice[note];          //Retrigger the same note on the same voice.
+        if( v >= 0 ){
+            Unlink(v);
+        }else if( nFreeVoices > 0 ){
+            v = freeVoices[--nFreeVoices];
+        }else{
+            v = oldestActive;               //Steal
+            Unlink(v);
+            noteToVoice[pool[v].note] = -1;
+        }
+
+        pool[v].note = note;
+        noteToVoice[note] = v;
+        LinkNewest(v);
+
+        pool[v].osc->SetFrequency( NoteToFrequency(note) * pitchBendRatio );
+        pool[v].osc->SetAmplitude( velocityLevel * (float)velocity / 127.0f );
+        pool[v].osc->Mute(false);
+    }
+
+    void NoteOff( int note )
+    {
+        const int v = noteToVoice[note];
+        if( v < 0 )
+            return;
+        pool[v].osc->Mute(true);
+        Unlink(v);
+        noteToVoice[note] = -1;
+        pool[v].note = -1;
+        freeVoices[nFreeVoices++] = v;
+    }
+
+    void AllNotesOff( void )
+    {
+        while( oldestActive >= 0 )
+            NoteOff( pool[oldestActive].note );
+    }
+
+    void PitchBend( int value )
+    {
+        pitchBendRatio = std::pow( 2.0f, pitchBendRange * (float)(value - 8192) / (8192.0f * 12.0f) );
+        for( int v = oldestActive; v >= 0; v = pool[v].newer )
+            pool[v].osc->SetFrequency( NoteToFrequency(pool[v].note) * pitchBendRatio );
+    }
+
+    void Controller( int controller, int value )
+    {
+        if( controller == 120 || controller == 123 ){       //All Sound Off, All Notes Off
+            AllNotesOff();
+            return;
+        }
+
+        const float normalised = (float)value / 127.0f;
+        for( unsigned int m = 0; m < nControllerMaps; m++ ){
+            const controller_map_t& map = controllerMaps[m];
+            if( map.controller != controller )
+                continue;
+
+            switch( map.target ){
+                case CC_TARGET_FREQUENCY:
+                    map.periodic->SetFrequency( map.min * std::pow( map.max / map.min, normalised ) );
+                    break;
+                case CC_TARGET_AMPLITUDE:
+                    map.generator->SetAmplitude( map.min + (map.max - map.min) * normalised );
+                    break;
+                case CC_TARGET_MUTE:
+                    map.generator->Mute( value >= 64 );
+                    break;
+            }
+        }
+    }
+};
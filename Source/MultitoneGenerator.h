@@ -0,0 +1,446 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Multitone (Additive) Generator using Inverse FFT Synthesis.
+ *
+ *  Rather than running one SineWaveOscillator per partial (O(partials) per sample), tones are written
+ *  directly into FFT bins (amplitude + phase) and a whole frame is synthesised with a single inverse FFT.
+ *  Cost is O(N log N) per frame regardless of how many partials are active, so 1000+ tone stimuli are cheap.
+ *
+ *  Two synthesis modes:
+ *  1) SYNTH_MODE_PERIODIC_LOOP - One frame is synthesised and looped. All tones are bin-centred, so the loop is exactly periodic.
+ *  2) SYNTH_MODE_OVERLAP_ADD   - Hann windowed frames at 50% overlap, re-synthesised every hop so tone changes are smoothed in.
+ *
+ *  Phase sets are provided for low crest factor stimuli (Schroeder, Newman), plus an iterative clipping
+ *  optimiser to push the crest factor down further.
+ *
+ *  Render ahead: the audio thread never runs a whole frame's synthesis inside one CalcSample(). The next frame is
+ *  rendered during the current hop in small slices (a few bins' sin/cos, one of SPLIT_COUNT sub-IFFTs, or one radix-2
+ *  combining pass), so the cost is spread evenly over the hop's callbacks. The frame IFFT is split by decimation in
+ *  time: SPLIT_COUNT IFFTs of frameSize / SPLIT_COUNT points, then log2(SPLIT_COUNT) butterfly passes.
+ *  A commit is therefore heard one hop later than it's picked up.
+ *
+ *  The edit side (OptimiseCrestFactor, CalcCrestFactor) has its own FFT, so editing never shares an FFT engine with
+ *  the audio thread.
+ *
+ *  NOTE: Requires the juce_dsp module (juce::dsp::FFT).
+ *
+ *  READING:
+ *  1) Schroeder, "Synthesis of Low-Peak-Factor Signals and Binary Sequences With Low Autocorrelation", 1970
+ *  2) Van der Ouderaa et al, "Peak Factor Minimization Using a Time-Frequency Domain Swapping Algorithm", 1988
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+
+class MultitoneGenerator : public SigGen
+{
+public:
+
+    typedef enum{
+        SYNTH_MODE_PERIODIC_LOOP,
+        SYNTH_MODE_OVERLAP_ADD,
+    }synth_mode_t;
+
+    typedef enum{
+        PHASE_SET_ZERO,             //Worst case crest factor (all partials peak together). Useful as a reference only.
+        PHASE_SET_RANDOM,
+        PHASE_SET_SCHROEDER,        //Low crest factor for arbitrary amplitude spectra.
+        PHASE_SET_NEWMAN,           //Low crest factor for flat spectra.
+    }phase_set_t;
+
+    static constexpr unsigned int DEFAULT_FFT_ORDER = 14;       //16384 point frame. ~2.9Hz bin spacing @ 48K.
+
+    //fftOrder must be greater than SPLIT_ORDER.
+    MultitoneGenerator( unsigned int fftOrder = DEFAULT_FFT_ORDER ) :
+        editFft( (int)fftOrder ),
+        leafFft( (int)(fftOrder - SPLIT_ORDER) ),
+        frameSize( 1u << fftOrder ),
+        hopSize( frameSize >> 1 ),
+        numBins( (frameSize >> 1) + 1 ),
+        leafSize( frameSize >> SPLIT_ORDER )
+    {
+        binAmplitude.assign(numBins, 0.0f);
+        binPhase.assign(numBins, 0.0f);
+        activeAmplitude.assign(numBins, 0.0f);
+        activePhase.assign(numBins, 0.0f);
+        frame.assign(frameSize, 0.0f);
+        olaBuffer.assign(frameSize, 0.0f);
+
+        //Periodic Hann window. Sums to exactly 1.0 at 50% overlap, so a steady spectrum is reconstructed without modulation.
+        window.resize(frameSize);
+        for( unsigned int n = 0; n < frameSize; n++ )
+            window[n] = 0.5f - 0.5f * std::cos( TWO_PI * (float)n / (float)frameSize );
+
+        //Render ahead buffers, and e^(j.2pi.i/N) for the combining passes.
+        spectrum.assign(numBins, std::complex<float>());
+        leaf.assign(leafSize, std::complex<float>());
+        work.assign(frameSize, std::complex<float>());
+        renderedFrame.assign(frameSize, 0.0f);
+        twiddle.resize(frameSize >> 1);
+        for( unsigned int i = 0; i < (frameSize >> 1); i++ )
+            twiddle[i] = std::polar( 1.0f, (float)(2.0 * 3.141592653589793 * (double)i / (double)frameSize) );
+
+        //Every slice is done by the end of the hop, with one interval to spare.
+        const unsigned int totalSlices = (numBins + leafSize - 1) / leafSize + SPLIT_COUNT + SPLIT_ORDER + 1;
+        sliceInterval = std::max( 1u, hopSize / (totalSlices + 1) );
+    }
+    ~MultitoneGenerator(){}
+
+    void SetSampleRate( float rate ){
+        fS = rate;
+    }
+
+    //Published like the spectrum (and with any pending spectrum edits): the audio thread switches at a frame boundary.
+    void SetSynthMode( synth_mode_t mode ){
+        pendingSynthMode = mode;
+        spectrumPending.store(true, std::memory_order_release);
+    }
+
+    unsigned int GetFrameSize( void ) const { return frameSize; }
+    float GetBinSpacingHz( void ) const { return fS / (float)frameSize; }
+
+    /*
+     *  Spectrum Editing. These write to the "pending" spectrum, which is picked up by the audio thread at the next
+     *  frame boundary once Commit() is called. Don't edit while a previous Commit() is still pending (IsCommitPending()).
+     */
+    void ClearTones( void ){
+        std::fill(binAmplitude.begin(), binAmplitude.end(), 0.0f);
+        std::fill(binPhase.begin(), binPhase.end(), 0.0f);
+    }
+
+    void SetBin( unsigned int bin, float amp, float phase ){
+        if( bin >= numBins )
+            return;
+        binAmplitude[bin] = amp;
+        binPhase[bin] = phase;
+    }
+
+    //Snaps the requested frequency to the nearest bin (keeps the frame exactly periodic). Returns the bin used.
+    unsigned int AddTone( float freqHz, float amp, float phase = 0.0f ){
+        unsigned int bin = FrequencyToBin(freqHz);
+        SetBin(bin, amp, phase);
+        return bin;
+    }
+
+    unsigned int FrequencyToBin( float freqHz ) const {
+        const float bin = std::round( freqHz / GetBinSpacingHz() );
+        if( bin < 1.0f ) return 1;                          //Never use DC.
+        if( bin > (float)(numBins - 2) ) return numBins - 2; //Never use Nyquist.
+        return (unsigned int)bin;
+    }
+
+    //Overwrites the phase of every active (non-zero amplitude) bin.
+    void ApplyPhaseSet( phase_set_t set )
+    {
+        float sumPower = 0.0f;
+        unsigned int nActive = 0;
+        for( unsigned int k = 0; k < numBins; k++ ){
+            if( binAmplitude[k] != 0.0f ){
+                sumPower += binAmplitude[k] * binAmplitude[k];
+                nActive++;
+            }
+        }
+        if( nActive == 0 )
+            return;
+
+        /*
+         *  Schroeder (general form): phi_n = phi_1 - 2pi * sum_{l<n} (n - l) * p_l, where p_l is the relative power of tone l.
+         *  Computed incrementally: phi_n = phi_{n-1} - 2pi * sum_{l<n} p_l.
+         */
+        double schroederPhase = 0.0, cumulativePower = 0.0;
+        unsigned int toneIndex = 0;
+        for( unsigned int k = 0; k < numBins; k++ ){
+            if( binAmplitude[k] == 0.0f )
+                continue;
+
+            double phase = 0.0;
+            switch( set ){
+                case PHASE_SET_ZERO:
+                    break;
+                case PHASE_SET_RANDOM:
+                    phase = TWO_PI * random.nextFloat();
+                    break;
+                case PHASE_SET_SCHROEDER:
+                    schroederPhase -= TWO_PI * cumulativePower;
+                    cumulativePower += (binAmplitude[k] * binAmplitude[k]) / sumPower;
+                    phase = schroederPhase;
+                    break;
+                case PHASE_SET_NEWMAN:
+                    phase = PI * (double)toneIndex * (double)toneIndex / (double)nActive;
+                    break;
+            }
+            binPhase[k] = (float)std::fmod( phase, (double)TWO_PI );
+            toneIndex++;
+        }
+    }
+
+    /*
+     *  Iterative clipping crest factor optimiser (time-frequency swapping). Synthesise, clip the peaks, transform back
+     *  and keep only the new phases (amplitudes are restored each pass). Runs on the calling thread - don't call from the audio callback.
+     *  Returns the crest factor (linear) of the final phase set.
+     */
+    float OptimiseCrestFactor( unsigned int iterations, float clipRatio = 0.8f )
+    {
+        std::vector<float> work(frameSize * 2);
+
+        for( unsigned int i = 0; i < iterations; i++ ){
+            SynthesiseFrame(binAmplitude, binPhase, 0, work.data());
+
+            float peak = 0.0f;
+            for( unsigned int n = 0; n < frameSize; n++ )
+                peak = std::max(peak, std::abs(work[n]));
+            const float clipLevel = peak * clipRatio;
+            juce::FloatVectorOperations::clip(work.data(), work.data(), -clipLevel, clipLevel, (int)frameSize);
+
+            editFft.performRealOnlyForwardTransform(work.data(), true);
+            for( unsigned int k = 0; k < numBins; k++ ){
+                if( binAmplitude[k] != 0.0f )
+                    binPhase[k] = std::atan2( work[2 * k + 1], work[2 * k] );
+            }
+        }
+
+        return CalcCrestFactor();
+    }
+
+    //Crest factor (peak / rms, linear) of the pending spectrum.
+    float CalcCrestFactor( void )
+    {
+        std::vector<float> work(frameSize * 2);
+        SynthesiseFrame(binAmplitude, binPhase, 0, work.data());
+
+        float peak = 0.0f, sumSquares = 0.0f;
+        for( unsigned int n = 0; n < frameSize; n++ ){
+            peak = std::max(peak, std::abs(work[n]));
+            sumSquares += work[n] * work[n];
+        }
+        const float rms = std::sqrt( sumSquares / (float)frameSize );
+        return rms > 0.0f ? peak / rms : 0.0f;
+    }
+
+    //Publish the pending spectrum to the audio thread.
+    void Commit( void ){
+        spectrumPending.store(true, std::memory_order_release);
+    }
+
+    //True until the audio thread has taken the last Commit() (or SetSynthMode()). Wait for this before editing again.
+    bool IsCommitPending( void ) const {
+        return spectrumPending.load(std::memory_order_acquire);
+    }
+
+    float CalcSample() override
+    {
+        if( readPosition == 0 )
+            BeginFrame();
+        else if( readPosition % sliceInterval == 0 )
+            RenderSlice();
+
+        const float sample = frame[readPosition];
+        if( ++readPosition >= (synthMode == SYNTH_MODE_PERIODIC_LOOP ? frameSize : hopSize) )
+            readPosition = 0;
+
+        return amplitude * sample;
+    }
+
+private:
+    static constexpr unsigned int SPLIT_ORDER = 4;
+    static constexpr unsigned int SPLIT_COUNT = 1u << SPLIT_ORDER;
+
+    typedef enum{
+        RENDER_IDLE,
+        RENDER_SPECTRUM,        //Bin amplitude/phase -> complex, leafSize bins per slice
+        RENDER_LEAVES,          //One sub-IFFT per slice
+        RENDER_COMBINE,         //One radix-2 pass per slice
+        RENDER_OUTPUT,          //Real part (windowed for overlap-add) -> renderedFrame
+        RENDER_DONE,
+    }render_stage_t;
+
+    juce::dsp::FFT editFft;             //Edit side only
+    juce::dsp::FFT leafFft;             //Audio thread only
+    const unsigned int frameSize, hopSize, numBins, leafSize;
+    float fS = 48000;       //default to 48K.
+    synth_mode_t pendingSynthMode = SYNTH_MODE_PERIODIC_LOOP;     //Edit side
+    synth_mode_t synthMode = SYNTH_MODE_PERIODIC_LOOP;            //Audio side
+
+    std::vector<float> binAmplitude, binPhase;          //Pending (edit side)
+    std::vector<float> activeAmplitude, activePhase;    //Active (audio side)
+    std::atomic<bool> spectrumPending { false };
+
+    std::vector<float> frame;           //Output frame (periodic mode) or completed hop (OLA mode)
+    std::vector<float> olaBuffer;
+    std::vector<float> window;
+    unsigned int readPosition = 0;
+    uint64_t frameIndex = 0;
+    bool frameValid = false;
+
+    //Render ahead (audio thread)
+    std::vector<std::complex<float>> spectrum, leaf, work, twiddle;
+    std::vector<float> renderedFrame;
+    render_stage_t renderStage = RENDER_IDLE;
+    synth_mode_t renderMode = SYNTH_MODE_PERIODIC_LOOP;
+    unsigned int renderStep = 0;
+    bool renderOddHop = false;
+    unsigned int sliceInterval = 1;
+
+    juce::Random random;
+
+    /*
+     *  Edit side. Fill dest[0..N-1] with sum_k A_k * cos(2pi*k*n/N + phi_k + k*pi*frameOffset).
+     *  k*pi*frameOffset is the phase advance for frameOffset hops of N/2 samples, i.e. a sign flip on odd bins for odd offsets.
+     */
+    void SynthesiseFrame( const std::vector<float>& amp, const std::vector<float>& phase, uint64_t frameOffset, float* dest )
+    {
+        const float binScale = (float)frameSize * 0.5f;     //juce::dsp::FFT inverse is scaled by 1/N
+        const bool oddHop = (frameOffset & 1) != 0;
+
+        for( unsigned int k = 0; k < numBins; k++ ){
+            float a = amp[k] * binScale;
+            if( oddHop && (k & 1) )
+                a = -a;
+            dest[2 * k]     = a * std::cos(phase[k]);
+            dest[2 * k + 1] = a * std::sin(phase[k]);
+        }
+        editFft.performRealOnlyInverseTransform(dest);
+    }
+
+    //Cleared only once the copy is taken, so IsCommitPending() stays true while the pending spectrum is being read.
+    void TakePendingSpectrum( void )
+    {
+        activeAmplitude = binAmplitude;     //Same size, no reallocation.
+        activePhase = binPhase;
+        renderMode = pendingSynthMode;
+        spectrumPending.store(false, std::memory_order_release);
+    }
+
+    void StartRender( void )
+    {
+        if( renderMode == SYNTH_MODE_OVERLAP_ADD && synthMode != SYNTH_MODE_OVERLAP_ADD )
+            frameIndex = 0;
+        renderOddHop = renderMode == SYNTH_MODE_OVERLAP_ADD && (frameIndex++ & 1);
+        renderStage = RENDER_SPECTRUM;
+        renderStep = 0;
+    }
+
+    /*
+     *  At each frame (periodic) or hop (OLA) boundary: take the frame rendered during the last one, and start the next.
+     *  Overlap-add needs a new frame every hop, so a render that hasn't finished (only ever the very first) is completed
+     *  here. A looped frame just keeps playing until its replacement is ready.
+     */
+    void BeginFrame( void )
+    {
+        if( !frameValid && renderStage == RENDER_IDLE ){
+            if( spectrumPending.load(std::memory_order_acquire) )
+                TakePendingSpectrum();
+            StartRender();
+        }
+        if( renderStage != RENDER_IDLE && (synthMode == SYNTH_MODE_OVERLAP_ADD || !frameValid) ){
+            while( renderStage != RENDER_DONE )
+                RenderSlice();
+        }
+
+        if( renderStage == RENDER_DONE ){
+            if( renderMode == SYNTH_MODE_PERIODIC_LOOP ){
+                std::copy(renderedFrame.begin(), renderedFrame.end(), frame.begin());
+            }else{
+                if( synthMode != SYNTH_MODE_OVERLAP_ADD )
+                    std::fill(olaBuffer.begin(), olaBuffer.end(), 0.0f);
+
+                //Overlap-Add: Shift the OLA buffer by one hop, then add the next windowed frame.
+                std::copy(olaBuffer.begin() + hopSize, olaBuffer.end(), olaBuffer.begin());
+                std::fill(olaBuffer.begin() + hopSize, olaBuffer.end(), 0.0f);
+                juce::FloatVectorOperations::add(olaBuffer.data(), renderedFrame.data(), (int)frameSize);
+                std::copy(olaBuffer.begin(), olaBuffer.begin() + hopSize, frame.begin());
+            }
+            synthMode = renderMode;
+            frameValid = true;
+            renderStage = RENDER_IDLE;
+        }
+
+        //Overlap-add always renders the next frame (with any new spectrum). A loop only renders when one is committed (RenderSlice).
+        if( synthMode == SYNTH_MODE_OVERLAP_ADD && renderStage == RENDER_IDLE ){
+            if( spectrumPending.load(std::memory_order_acquire) )
+                TakePendingSpectrum();
+            StartRender();
+        }
+    }
+
+    //One slice of the render ahead. Slices are similar in cost, and there are few enough of them to finish within a hop.
+    void RenderSlice( void )
+    {
+        switch( renderStage ){
+            case RENDER_IDLE:
+                if( synthMode == SYNTH_MODE_PERIODIC_LOOP && spectrumPending.load(std::memory_order_acquire) ){
+                    TakePendingSpectrum();
+                    StartRender();
+                }
+                break;
+
+            case RENDER_SPECTRUM:{
+                //Sub-IFFTs are scaled by 1/leafSize, and the conjugate bin doubles each tone.
+                const float binScale = (float)leafSize * 0.5f;
+                const unsigned int end = std::min( renderStep + leafSize, numBins );
+                for( unsigned int k = renderStep; k < end; k++ ){
+                    float a = activeAmplitude[k] * binScale;
+                    if( renderOddHop && (k & 1) )
+                        a = -a;
+                    spectrum[k] = std::polar( a, activePhase[k] );
+                }
+                renderStep = end;
+                if( renderStep == numBins ){
+                    renderStage = RENDER_LEAVES;
+                    renderStep = 0;
+                }
+                break;
+            }
+
+            case RENDER_LEAVES:{
+                //Leaf b holds bins r, r + SPLIT_COUNT, r + 2.SPLIT_COUNT... with r = bitreverse(b), i.e. the first
+                //log2(leafSize) passes of an in-place decimation in time IFFT. Bins above Nyquist are conjugates.
+                unsigned int r = 0;
+                for( unsigned int bit = 0; bit < SPLIT_ORDER; bit++ )
+                    r |= ((renderStep >> bit) & 1u) << (SPLIT_ORDER - 1 - bit);
+                for( unsigned int m = 0; m < leafSize; m++ ){
+                    const unsigned int k = r + SPLIT_COUNT * m;
+                    leaf[m] = k < numBins ? spectrum[k] : std::conj( spectrum[frameSize - k] );
+                }
+                leafFft.perform( leaf.data(), work.data() + renderStep * leafSize, true );
+                if( ++renderStep == SPLIT_COUNT ){
+                    renderStage = RENDER_COMBINE;
+                    renderStep = 0;
+                }
+                break;
+            }
+
+            case RENDER_COMBINE:{
+                const unsigned int half = leafSize << renderStep;
+                const unsigned int stride = frameSize / (half * 2);
+                for( unsigned int start = 0; start < frameSize; start += half * 2 ){
+                    std::complex<float>* a = work.data() + start;
+                    std::complex<float>* b = a + half;
+                    for( unsigned int n = 0; n < half; n++ ){
+                        const std::complex<float> t = twiddle[n * stride] * b[n];
+                        b[n] = a[n] - t;
+                        a[n] += t;
+                    }
+                }
+                if( ++renderStep == SPLIT_ORDER )
+                    renderStage = RENDER_OUTPUT;
+                break;
+            }
+
+            case RENDER_OUTPUT:
+                for( unsigned int n = 0; n < frameSize; n++ )
+                    renderedFrame[n] = work[n].real();
+                if( renderMode == SYNTH_MODE_OVERLAP_ADD )
+                    juce::FloatVectorOperations::multiply(renderedFrame.data(), window.data(), (int)frameSize);
+                renderStage = RENDER_DONE;
+                break;
+
+            case RENDER_DONE:
+                break;
+        }
+    }
+};
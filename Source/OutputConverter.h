@@ -0,0 +1,254 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Output Format Conversion (float -> int16 / int24 / int32).
+ *
+ *  Converts blocks of the float mix into interleaved little endian integer samples, e.g. for embedded reference vectors
+ *  and file renders. Each channel is processed in fixed CONVERT_CHUNK pieces through branch free loops the compiler
+ *  vectorises (scale, dither, clamp, round), then interleaved, so conversion runs close to memory bandwidth.
+ *
+ *  - Dither: none, or TPDF (two uniform variates per sample, +/-1 LSB peak) from BlockRandom, which fills a whole chunk
+ *    of random numbers per call without a serial dependency.
+ *  - Noise shaping (optional): error feedback, first order (1 - z^-1) or second order (1 - z^-1)^2. The quantisation
+ *    error moves up towards Nyquist at the cost of more total noise. Error feedback is recursive, so shaped channels
+ *    are quantised a sample at a time; everything else stays vectorised.
+ *  - Samples outside full scale (after dither) are clamped and counted.
+ *
+ *  Full scale: +/-1.0f maps to +/-2^(bits-1), i.e. -1.0f is the most negative code and +1.0f clips by one LSB.
+ *  int32 goes through float, so only the top 24 bits carry signal (dither is pointless there and is skipped).
+ *
+ *  Not thread safe: use one converter per thread. ConvertBlock() never allocates, so it's fine on the audio thread.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+
+/*
+ *  Fast block random number generator. Counter based: each output is a hash (lowbias32) of its own index, so a block has
+ *  no serial dependency and the fill loops vectorise. Period 2^32 outputs per seed.
+ */
+class BlockRandom
+{
+public:
+    BlockRandom( uint32_t seed = 0x9E3779B9u ){ Seed(seed); }
+
+    void Seed( uint32_t seed )
+    {
+        key = seed;
+        counter = 0;
+    }
+
+    //[0, 1)
+    void FillUniform( float* dest, unsigned int numSamples )
+    {
+        const uint32_t base = counter;
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            uint32_t z = ((base + n) * 0x9E3779B9u) ^ key;
+            z ^= z >> 16;
+            z *= 0x7FEB352Du;
+            z ^= z >> 15;
+            z *= 0x846CA68Bu;
+            z ^= z >> 16;
+            dest[n] = (float)(int32_t)(z >> 8) * (1.0f / 16777216.0f);
+        }
+        counter += numSamples;
+    }
+
+    //Triangular PDF in (-peak, peak). scratch holds numSamples.
+    void FillTriangular( float* dest, float* scratch, unsigned int numSamples, float peak )
+    {
+        FillUniform( dest, numSamples );
+        FillUniform( scratch, numSamples );
+        for( unsigned int n = 0; n < numSamples; n++ )
+            dest[n] = (dest[n] - scratch[n]) * peak;
+    }
+
+private:
+    uint32_t key = 0, counter = 0;
+};
+
+//==============================================================================
+class OutputConverter
+{
+public:
+
+    typedef enum{
+        FORMAT_INT16,
+        FORMAT_INT24,       //Packed, 3 bytes per sample.
+        FORMAT_INT32,
+    }sample_format_t;
+
+    typedef enum{
+        DITHER_NONE,
+        DITHER_TPDF,
+    }dither_t;
+
+    typedef enum{
+        NOISE_SHAPING_NONE,
+        NOISE_SHAPING_FIRST_ORDER,
+        NOISE_SHAPING_SECOND_ORDER,
+    }noise_shaping_t;
+
+    static constexpr unsigned int MAX_CHANNELS = 64;
+    static constexpr unsigned int CONVERT_CHUNK = 256;
+
+    OutputConverter(){}
+    ~OutputConverter(){}
+
+    //Resets the noise shaping state and clip count.
+    void SetFormat( sample_format_t newFormat, dither_t newDither = DITHER_TPDF, noise_shaping_t newShaping = NOISE_SHAPING_NONE )
+    {
+        format = newFormat;
+        dither = newDither;
+        shaping = newShaping;
+        Reset();
+    }
+
+    void Reset( void )
+    {
+        std::fill( std::begin(error1), std::end(error1), 0.0f );
+        std::fill( std::begin(error2), std::end(error2), 0.0f );
+        clipCount = 0;
+    }
+
+    sample_format_t GetFormat( void ) const { return format; }
+    unsigned int GetBytesPerSample( void ) const { return format == FORMAT_INT16 ? 2 : (format == FORMAT_INT24 ? 3 : 4); }
+    uint64_t GetClipCount( void ) const { return clipCount; }
+
+    /*
+     *  Converts numSamples frames of numChannels into dest, interleaved (GetBytesPerSample() * numChannels * numSamples bytes).
+     *  Returns the number of samples clipped in this block.
+     *  More than MAX_CHANNELS converts nothing and returns 0 without logging (this runs on the audio thread), so check the
+     *  channel count when setting up.
+     */
+    unsigned int ConvertBlock( const float* const* channels, unsigned int numChannels, unsigned int numSamples, void* dest )
+    {
+        if( numChannels > MAX_CHANNELS )
+            return 0;
+
+        unsigned int clipped = 0;
+        uint8_t* out = static_cast<uint8_t*>(dest);
+        const size_t frameBytes = (size_t)GetBytesPerSample() * numChannels;
+
+        for( unsigned int start = 0; start < numSamples; start += CONVERT_CHUNK ){
+            const unsigned int length = std::min( CONVERT_CHUNK, numSamples - start );
+            for( unsigned int ch = 0; ch < numChannels; ch++ ){
+                clipped += Quantise( channels[ch] + start, ch, length );
+                Interleave( out + (size_t)start * frameBytes, ch, numChannels, length );
+            }
+        }
+
+        clipCount += clipped;
+        return clipped;
+    }
+
+    //Convenience for an engine buffer region.
+    unsigned int ConvertBlock( const juce::AudioBuffer<float>& buffer, int startSample, int numSamples, void* dest )
+    {
+        const float* channels[MAX_CHANNELS];
+        const unsigned int numChannels = std::min( (unsigned int)buffer.getNumChannels(), MAX_CHANNELS );
+        for( unsigned int ch = 0; ch < numChannels; ch++ )
+            channels[ch] = buffer.getReadPointer( (int)ch, startSample );
+        return ConvertBlock( channels, numChannels, (unsigned int)numSamples, dest );
+    }
+
+private:
+    sample_format_t format = FORMAT_INT16;
+    dither_t dither = DITHER_TPDF;
+    noise_shaping_t shaping = NOISE_SHAPING_NONE;
+    uint64_t clipCount = 0;
+
+    BlockRandom random;
+    float error1[MAX_CHANNELS] = {}, error2[MAX_CHANNELS] = {};        //Noise shaping: e[n-1], e[n-2] per channel
+
+    alignas(32) float scaled[CONVERT_CHUNK];
+    alignas(32) float noise[CONVERT_CHUNK];
+    alignas(32) float scratch[CONVERT_CHUNK];
+    alignas(32) int32_t quantised[CONVERT_CHUNK];
+
+    float GetFullScale( void ) const { return format == FORMAT_INT16 ? 32768.0f : (format == FORMAT_INT24 ? 8388608.0f : 2147483648.0f); }
+
+    //input -> quantised[], clamped to the format's range. Returns the number clipped.
+    unsigned int Quantise( const float* input, unsigned int ch, unsigned int length )
+    {
+        const float fullScale = GetFullScale();
+        const float maxCode = format == FORMAT_INT32 ? 2147483520.0f : fullScale - 1.0f;     //Largest float below 2^31
+        const float minCode = -fullScale;
+        const bool dithered = dither == DITHER_TPDF && format != FORMAT_INT32;
+
+        juce::FloatVectorOperations::multiply( scaled, input, fullScale, (int)length );
+
+        if( dithered ){
+            random.FillTriangular( noise, scratch, length, 1.0f );
+            juce::FloatVectorOperations::add( scaled, noise, (int)length );
+        }
+
+        if( shaping != NOISE_SHAPING_NONE && format != FORMAT_INT32 )
+            ErrorFeedback( ch, length, dithered ? noise : nullptr );
+
+        const float clipHigh = maxCode + 0.5f, clipLow = minCode - 0.5f;
+        const float* y = scaled;
+        int32_t* q = quantised;
+        unsigned int clipped = 0;
+        for( unsigned int n = 0; n < length; n++ ){
+            clipped += (y[n] > clipHigh) | (y[n] < clipLow);
+            const float clamped = std::min( std::max( y[n], minCode ), maxCode );
+            q[n] = (int32_t)(clamped + std::copysign( 0.5f, clamped ));     //Round half away from zero (truncating convert vectorises).
+        }
+        return clipped;
+    }
+
+    /*
+     *  Error feedback: v = x - H(e), q = round(v + d), e = q - v. scaled[] holds x + d on entry, q on return.
+     *  Only this chain is serial. The error is taken before clamping, so it stays within +/-1.5 LSB and the loop can't
+     *  run away on clipped input; clamping, clip counting and conversion are left to the block loop.
+     */
+    void ErrorFeedback( unsigned int ch, unsigned int length, const float* dither )
+    {
+        const float h1 = shaping == NOISE_SHAPING_SECOND_ORDER ? 2.0f : 1.0f;
+        const float h2 = shaping == NOISE_SHAPING_SECOND_ORDER ? -1.0f : 0.0f;
+        float e1 = error1[ch], e2 = error2[ch];
+
+        for( unsigned int n = 0; n < length; n++ ){
+            const float y = scaled[n] - (h1 * e1 + h2 * e2);
+            const float q = std::nearbyint( y );
+            e2 = e1;
+            e1 = dither ? (q - y) + dither[n] : q - y;
+            scaled[n] = q;
+        }
+
+        error1[ch] = e1;
+        error2[ch] = e2;
+    }
+
+    void Interleave( uint8_t* frameStart, unsigned int ch, unsigned int numChannels, unsigned int length )
+    {
+        switch( format ){
+            case FORMAT_INT16:{
+                int16_t* out = reinterpret_cast<int16_t*>(frameStart) + ch;
+                for( unsigned int n = 0; n < length; n++ )
+                    out[(size_t)n * numChannels] = (int16_t)quantised[n];
+                break;
+            }
+            case FORMAT_INT24:{
+                uint8_t* out = frameStart + 3 * ch;
+                const size_t stride = 3 * (size_t)numChannels;
+                for( unsigned int n = 0; n < length; n++ ){
+                    const uint32_t q = (uint32_t)quantised[n];
+                    out[n * stride]     = (uint8_t)q;
+                    out[n * stride + 1] = (uint8_t)(q >> 8);
+                    out[n * stride + 2] = (uint8_t)(q >> 16);
+                }
+                break;
+            }
+            case FORMAT_INT32:{
+                int32_t* out = reinterpret_cast<int32_t*>(frameStart) + ch;
+                for( unsigned int n = 0; n < length; n++ )
+                    out[(size_t)n * numChannels] = quantised[n];
+                break;
+            }
+        }
+    }
+};
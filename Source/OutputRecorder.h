@@ -0,0 +1,201 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Output Recorder (Integer WAV Render Of The Mix).
+ *
+ *  An engine output tap that converts every mixed block with an OutputConverter (int16 / int24 / int32, optional TPDF
+ *  dither and noise shaping) and records it to a PCM WAV file, e.g. for embedded reference vectors.
+ *
+ *  - The audio thread only converts: the interleaved integer frames go straight into a lock free ring (AbstractFifo),
+ *    and a background thread writes them to disk, so file I/O never blocks the callback.
+ *  - If the writer falls more than a ring behind, whole blocks are dropped and counted rather than the callback
+ *    waiting. The file is always a contiguous run of frames otherwise.
+ *  - Start()/Stop() come from one control thread. The tap can stay attached to the engine throughout: it does nothing
+ *    while stopped, and Stop() waits for a block in progress before finishing the file (the same handshake as
+ *    ArbitraryWaveformGenerator::Close()).
+ *
+ *  WAV (RIFF) sizes are 32 bit, so recording stops adding frames at the 4GB limit (they're counted as dropped).
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGenEngine.h"
+#include "OutputConverter.h"
+#include "stdio.h"
+
+class OutputRecorder : public SigGenOutputTap,
+                       private juce::Thread
+{
+public:
+    static constexpr double RING_SECONDS = 2.0;
+
+    OutputRecorder() : juce::Thread("SigGen Output Recorder") {}
+    ~OutputRecorder() override { Stop(); }
+
+    /*
+     *  Records the first numChannels output channels to file (replaced if it exists) from the next block.
+     *  sampleRate is only written to the header; it should match the engine.
+     */
+    bool Start( const juce::File& file, unsigned int numChannels, double sampleRate,
+                OutputConverter::sample_format_t format = OutputConverter::FORMAT_INT24,
+                OutputConverter::dither_t dither = OutputConverter::DITHER_TPDF,
+                OutputConverter::noise_shaping_t shaping = OutputConverter::NOISE_SHAPING_NONE )
+    {
+        Stop();
+        if( numChannels == 0 || numChannels > OutputConverter::MAX_CHANNELS || sampleRate <= 0.0 ){
+            printf("WARNING: Invalid Recording Format (%u channels, %f Hz)\r\n", numChannels, sampleRate);
+            return false;
+        }
+
+        stream.reset( new juce::FileOutputStream(file) );
+        if( !stream->openedOk() || !stream->setPosition(0) ){
+            printf("WARNING: Can't Record To %s\r\n", file.getFullPathName().toRawUTF8());
+            stream.reset();
+            return false;
+        }
+
+        converter.SetFormat( format, dither, shaping );
+        channels = numChannels;
+        rate = sampleRate;
+        frameBytes = converter.GetBytesPerSample() * numChannels;
+        dataBytes = 0;
+        droppedFrames.store( 0, std::memory_order_relaxed );
+
+        const int ringFrames = (int)(sampleRate * RING_SECONDS);
+        fifo.reset( new juce::AbstractFifo(ringFrames) );
+        ring.assign( (size_t)ringFrames * frameBytes, 0 );
+
+        WriteHeader();
+        startThread();
+        recording.store(true);
+        return true;
+    }
+
+    //Finishes the file: waits out a block in progress, writes everything still in the ring and fills in the header sizes.
+    void Stop( void )
+    {
+        recording.store(false);
+        while( converting.load() )
+            std::this_thread::yield();
+
+        if( stream == nullptr )
+            return;
+        stopThread(2000);
+        WriteFrames();
+        WriteHeader();
+        stream->flush();
+        stream.reset();
+    }
+
+    bool IsRecording( void ) const { return recording.load(std::memory_order_relaxed); }
+    juce::uint64 GetDroppedFrames( void ) const { return droppedFrames.load(std::memory_order_relaxed); }
+    juce::uint64 GetClipCount( void ) const { return clipCount.load(std::memory_order_relaxed); }
+
+    //Audio thread (SigGenOutputTap). recording/converting are sequentially consistent with Stop().
+    void ProcessOutputBlock( const juce::AudioBuffer<float>& buffer, int startSample, int numSamples ) override
+    {
+        converting.store(true);
+        if( recording.load() ){
+            if( (unsigned int)buffer.getNumChannels() < channels || numSamples > fifo->getFreeSpace() ){
+                droppedFrames.fetch_add( (juce::uint64)numSamples, std::memory_order_relaxed );
+            }else{
+                const float* input[OutputConverter::MAX_CHANNELS];
+                for( unsigned int ch = 0; ch < channels; ch++ )
+                    input[ch] = buffer.getReadPointer( (int)ch, startSample );
+
+                int start1, size1, start2, size2;
+                fifo->prepareToWrite( numSamples, start1, size1, start2, size2 );
+                converter.ConvertBlock( input, channels, (unsigned int)size1, ring.data() + (size_t)start1 * frameBytes );
+                if( size2 > 0 ){
+                    for( unsigned int ch = 0; ch < channels; ch++ )
+                        input[ch] += size1;
+                    converter.ConvertBlock( input, channels, (unsigned int)size2, ring.data() + (size_t)start2 * frameBytes );
+                }
+                fifo->finishedWrite( size1 + size2 );
+                clipCount.store( converter.GetClipCount(), std::memory_order_relaxed );
+            }
+        }
+        converting.store(false);
+    }
+
+private:
+    static constexpr juce::uint64 MAX_DATA_BYTES = 0xFFFFFFFFull - 36;      //RIFF size limit
+
+    //Audio thread while recording, control thread otherwise.
+    OutputConverter converter;
+    unsigned int channels = 0;
+    size_t frameBytes = 0;
+    std::unique_ptr<juce::AbstractFifo> fifo;
+    std::vector<uint8_t> ring;
+
+    std::atomic<bool> recording { false };
+    std::atomic<bool> converting { false };
+    std::atomic<juce::uint64> droppedFrames { 0 };
+    std::atomic<juce::uint64> clipCount { 0 };
+
+    //Writer thread while recording, control thread otherwise.
+    std::unique_ptr<juce::FileOutputStream> stream;
+    double rate = 48000.0;
+    juce::uint64 dataBytes = 0;
+
+    void run() override
+    {
+        while( !threadShouldExit() ){
+            WriteFrames();
+            wait(10);
+        }
+    }
+
+    void WriteFrames( void )
+    {
+        const int ready = fifo->getNumReady();
+        if( ready == 0 )
+            return;
+
+        int start1, size1, start2, size2;
+        fifo->prepareToRead( ready, start1, size1, start2, size2 );
+        WriteData( ring.data() + (size_t)start1 * frameBytes, (size_t)size1 * frameBytes );
+        if( size2 > 0 )
+            WriteData( ring.data() + (size_t)start2 * frameBytes, (size_t)size2 * frameBytes );
+        fifo->finishedRead( size1 + size2 );
+    }
+
+    void WriteData( const uint8_t* data, size_t bytes )
+    {
+        if( dataBytes + bytes > MAX_DATA_BYTES ){
+            droppedFrames.fetch_add( bytes / frameBytes, std::memory_order_relaxed );
+            return;
+        }
+        stream->write( data, bytes );
+        dataBytes += bytes;
+    }
+
+    //44 byte PCM header, rewritten with the final sizes by Stop().
+    void WriteHeader( void )
+    {
+        uint8_t header[44];
+        auto put32 = [&header]( int at, juce::uint32 v ){ for( int b = 0; b < 4; b++ ) header[at + b] = (uint8_t)(v >> (8 * b)); };
+        auto put16 = [&header]( int at, juce::uint32 v ){ header[at] = (uint8_t)v; header[at + 1] = (uint8_t)(v >> 8); };
+
+        std::memcpy( header, "RIFF", 4 );
+        put32( 4, (juce::uint32)(36 + dataBytes) );
+        std::memcpy( header + 8, "WAVEfmt ", 8 );
+        put32( 16, 16 );
+        put16( 20, 1 );                                                 //PCM
+        put16( 22, channels );
+        put32( 24, (juce::uint32)rate );
+        put32( 28, (juce::uint32)rate * (juce::uint32)frameBytes );     //Bytes per second
+        put16( 32, (juce::uint32)frameBytes );                          //Block align
+        put16( 34, converter.GetBytesPerSample() * 8 );
+        std::memcpy( header + 36, "data", 4 );
+        put32( 40, (juce::uint32)dataBytes );
+
+        const juce::int64 end = stream->getPosition();
+        stream->setPosition(0);
+        stream->write( header, sizeof(header) );
+        if( end > (juce::int64)sizeof(header) )
+            stream->setPosition(end);
+    }
+};
@@ -0,0 +1,330 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Oversampling Stage for Non-Band-Limited Generators.
+ *
+ *  Generators such as the naive SquareWaveOscillator (or any waveshaping) alias badly at the host rate. An
+ *  OversampledVoiceGroup renders its voices at 2x/4x/8x and decimates back to the host rate with a cascade of
+ *  polyphase half-band filters. It's opt-in per group, so only the voices that need it pay for it.
+ *
+ *  Filter types:
+ *  1) FILTER_TYPE_LINEAR_PHASE_FIR - Kaiser windowed half-band FIR. Every other tap is zero, so each stage is split into
+ *     even/odd polyphase branches at the output rate. Each tap is one juce::FloatVectorOperations::addWithMultiply over the block (SIMD).
+ *  2) FILTER_TYPE_MINIMUM_PHASE_IIR - Polyphase allpass half-band IIR (two parallel chains of 1st order allpasses in z^-2).
+ *     Much lower latency, but non-linear phase. Recursive, so it is processed one section at a time over the whole block.
+ *
+ *  READING:
+ *  1) Valenzuela & Constantinides, "Digital Signal Processing Schemes for Efficient Interpolation and Decimation", 1983
+ *  2) Laurent de Soras, HIIR library - polyphase IIR half-band design equations.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+
+class HalfBandDecimator
+{
+public:
+
+    typedef enum{
+        FILTER_TYPE_LINEAR_PHASE_FIR,
+        FILTER_TYPE_MINIMUM_PHASE_IIR,
+    }filter_type_t;
+
+    typedef enum{
+        FILTER_QUALITY_STANDARD,        //Intermediate cascade stages. Only have to protect the final passband.
+        FILTER_QUALITY_HIGH,            //Final stage (closest to the host rate). Sharpest transition.
+    }filter_quality_t;
+
+    HalfBandDecimator(){}
+    ~HalfBandDecimator(){}
+
+    void Prepare( filter_type_t type, filter_quality_t quality, unsigned int maxOutputSamples )
+    {
+        filterType = type;
+        maxOutput = maxOutputSamples;
+
+        if( filterType == FILTER_TYPE_LINEAR_PHASE_FIR )
+            DesignFIR( quality == FILTER_QUALITY_HIGH ? 16 : 6 );
+        else
+            DesignIIR( quality == FILTER_QUALITY_HIGH ? 8 : 4, quality == FILTER_QUALITY_HIGH ? 0.04 : 0.2 );
+
+        Reset();
+    }
+
+    void Reset( void )
+    {
+        std::fill(evenBuffer.begin(), evenBuffer.end(), 0.0f);
+        std::fill(oddBuffer.begin(), oddBuffer.end(), 0.0f);
+        std::fill(allpassX.begin(), allpassX.end(), 0.0f);
+        std::fill(allpassY.begin(), allpassY.end(), 0.0f);
+    }
+
+    //Group delay in samples at the input (higher) rate. Exact for the FIR, DC value for the IIR.
+    float GetLatencyInputSamples( void ) const { return latencyInputSamples; }
+
+    /*
+     *  Decimate 2 * numOutput input samples into numOutput output samples. In-place (output == input) is allowed.
+     */
+    void Process( const float* input, float* output, unsigned int numOutput )
+    {
+        jassert(numOutput <= maxOutput);
+
+        if( filterType == FILTER_TYPE_LINEAR_PHASE_FIR )
+            ProcessFIR(input, output, numOutput);
+        else
+            ProcessIIR(input, output, numOutput);
+    }
+
+private:
+    filter_type_t filterType = FILTER_TYPE_LINEAR_PHASE_FIR;
+    unsigned int maxOutput = 0;
+    float latencyInputSamples = 0.0f;
+
+    //FIR: y[n] = sum_i h[2i] * x[2n - 2i] + 0.5 * x[2n - (2m-1)]
+    unsigned int halfLength = 0;            //m
+    std::vector<float> evenTaps;            //h[0], h[2] ... h[4m-2]
+    std::vector<float> evenBuffer;          //[history (2m-1) | block]
+    std::vector<float> oddBuffer;           //[history (m)    | block]
+
+    //IIR: Allpass coefficients alternate between the two paths.
+    std::vector<float> allpassCoefs;
+    std::vector<float> allpassX, allpassY;
+    std::vector<float> pathBuffer[2];
+
+    void ProcessFIR( const float* input, float* output, unsigned int numOutput )
+    {
+        const unsigned int evenHistory = 2 * halfLength - 1;
+        const unsigned int oddHistory = halfLength;
+        float* even = evenBuffer.data() + evenHistory;
+        float* odd = oddBuffer.data() + oddHistory;
+
+        //Polyphase split.
+        for( unsigned int n = 0; n < numOutput; n++ ){
+            even[n] = input[2 * n];
+            odd[n] = input[2 * n + 1];
+        }
+
+        //Centre tap, then the even branch. Each tap is a vectorised multiply-accumulate across the whole block.
+        juce::FloatVectorOperations::copyWithMultiply(output, odd - halfLength, 0.5f, (int)numOutput);
+        for( unsigned int i = 0; i < evenTaps.size(); i++ )
+            juce::FloatVectorOperations::addWithMultiply(output, even - i, evenTaps[i], (int)numOutput);
+
+        //Keep the tail as history for the next block.
+        std::copy(evenBuffer.begin() + numOutput, evenBuffer.begin() + numOutput + evenHistory, evenBuffer.begin());
+        std::copy(oddBuffer.begin() + numOutput, oddBuffer.begin() + numOutput + oddHistory, oddBuffer.begin());
+    }
+
+    void ProcessIIR( const float* input, float* output, unsigned int numOutput )
+    {
+        float* path0 = pathBuffer[0].data();        //x[2n + 1]
+        float* path1 = pathBuffer[1].data();        //x[2n] (i.e. delayed by one input sample)
+        for( unsigned int n = 0; n < numOutput; n++ ){
+            path0[n] = input[2 * n + 1];
+            path1[n] = input[2 * n];
+        }
+
+        //y[n] = c * (x[n] - y[n-1]) + x[n-1], one section at a time so the state lives in registers.
+        for( unsigned int s = 0; s < allpassCoefs.size(); s++ ){
+            float* path = (s & 1) ? path1 : path0;
+            const float c = allpassCoefs[s];
+            float x1 = allpassX[s], y1 = allpassY[s];
+            for( unsigned int n = 0; n < numOutput; n++ ){
+                const float x = path[n];
+                y1 = c * (x - y1) + x1;
+                x1 = x;
+                path[n] = y1;
+            }
+            allpassX[s] = x1;
+            allpassY[s] = y1;
+        }
+
+        for( unsigned int n = 0; n < numOutput; n++ )
+            output[n] = 0.5f * (path0[n] + path1[n]);
+    }
+
+    static double BesselI0( double x )
+    {
+        double sum = 1.0, term = 1.0;
+        for( unsigned int k = 1; k < 32; k++ ){
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    void DesignFIR( unsigned int m )
+    {
+        static constexpr double KAISER_BETA = 8.0;       //~80dB stopband
+        halfLength = m;
+        const unsigned int length = 4 * m - 1;
+        const double centre = (double)(length - 1) * 0.5;
+
+        evenTaps.resize(2 * m);
+        for( unsigned int i = 0; i < 2 * m; i++ ){
+            const double t = (double)(2 * i) - centre;                       //Always odd, so sinc never hits 0/0.
+            const double sinc = std::sin( 0.5 * PI * t ) / (PI * t);
+            const double r = t / (centre + 1.0);
+            const double window = BesselI0( KAISER_BETA * std::sqrt( 1.0 - r * r ) ) / BesselI0( KAISER_BETA );
+            evenTaps[i] = (float)(sinc * window);
+        }
+
+        //Normalise DC gain: centre tap is 0.5, so the even branch must sum to 0.5 too.
+        float sum = 0.0f;
+        for( float tap : evenTaps ) sum += tap;
+        for( float& tap : evenTaps ) tap *= 0.5f / sum;
+
+        evenBuffer.assign(maxOutput + 2 * m - 1, 0.0f);
+        oddBuffer.assign(maxOutput + m, 0.0f);
+        latencyInputSamples = (float)centre;
+    }
+
+    /*
+     *  Allpass coefficients for a given number of coefficients and normalised transition bandwidth (HIIR design equations).
+     */
+    void DesignIIR( unsigned int numCoefs, double transition )
+    {
+        double k = std::tan( (1.0 - 2.0 * transition) * PI * 0.25 );
+        k *= k;
+        const double kksqrt = std::pow( 1.0 - k * k, 0.25 );
+        const double e = 0.5 * (1.0 - kksqrt) / (1.0 + kksqrt);
+        const double e4 = e * e * e * e;
+        const double q = e * (1.0 + e4 * (2.0 + e4 * (15.0 + 150.0 * e4)));
+        const unsigned int order = numCoefs * 2 + 1;
+
+        allpassCoefs.resize(numCoefs);
+        double delay[2] = { 0.0, 1.0 };     //Path group delays at DC (input rate). Path 1 has the extra sample delay.
+        for( unsigned int index = 0; index < numCoefs; index++ ){
+            const double c = index + 1;
+
+            double num = 0.0, term;
+            int i = 0, sign = 1;
+            do{
+                term = std::pow( q, (double)(i * (i + 1)) ) * std::sin( (i * 2 + 1) * c * PI / order ) * sign;
+                num += term;
+                sign = -sign;
+                i++;
+            }while( std::abs(term) > 1e-100 );
+
+            double den = 0.0;
+            i = 1; sign = -1;
+            do{
+                term = std::pow( q, (double)(i * i) ) * std::cos( i * 2 * c * PI / order ) * sign;
+                den += term;
+                sign = -sign;
+                i++;
+            }while( std::abs(term) > 1e-100 );
+
+            const double ww = (num * std::pow( q, 0.25 )) / (den + 0.5);
+            const double wwsq = ww * ww;
+            const double x = std::sqrt( (1.0 - wwsq * k) * (1.0 - wwsq / k) ) / (1.0 + wwsq);
+            const double coef = (1.0 - x) / (1.0 + x);
+            allpassCoefs[index] = (float)coef;
+
+            delay[index & 1] += 2.0 * (1.0 - coef) / (1.0 + coef);     //1st order allpass in z^-2
+        }
+
+        allpassX.assign(numCoefs, 0.0f);
+        allpassY.assign(numCoefs, 0.0f);
+        pathBuffer[0].assign(maxOutput, 0.0f);
+        pathBuffer[1].assign(maxOutput, 0.0f);
+        latencyInputSamples = (float)(0.5 * (delay[0] + delay[1]));
+    }
+
+    static constexpr double PI = 3.141592653589793238L;
+};
+
+//==============================================================================
+class OversampledVoiceGroup
+{
+public:
+
+    typedef enum{
+        OVERSAMPLING_2X = 1,        //Value is the number of half-band stages.
+        OVERSAMPLING_4X = 2,
+        OVERSAMPLING_8X = 3,
+    }oversampling_factor_t;
+
+    OversampledVoiceGroup( oversampling_factor_t factor = OVERSAMPLING_4X,
+                           HalfBandDecimator::filter_type_t type = HalfBandDecimator::FILTER_TYPE_LINEAR_PHASE_FIR ) :
+        nStages( (unsigned int)factor ),
+        filterType( type )
+    {}
+    ~OversampledVoiceGroup(){}
+
+    void AddVoice( SigGen* voice ){ voices.push_back(voice); }
+
+    //Periodic voices have their sample rate set to the oversampled rate in Prepare().
+    void AddVoice( PeriodicOscillator* voice ){
+        voices.push_back(voice);
+        periodicVoices.push_back(voice);
+    }
+
+    unsigned int GetOversamplingRatio( void ) const { return 1u << nStages; }
+
+    //Call from prepareToPlay. Allocates all working buffers.
+    void Prepare( double hostSampleRate, unsigned int maxBlockSize )
+    {
+        const unsigned int ratio = GetOversamplingRatio();
+        for( PeriodicOscillator* voice : periodicVoices )
+            voice->SetSampleRate( (float)(hostSampleRate * ratio) );
+
+        oversampledBuffer.assign(maxBlockSize * ratio, 0.0f);
+
+        stages.resize(nStages);
+        latencyHostSamples = 0.0f;
+        for( unsigned int s = 0; s < nStages; s++ ){
+            //Stage 0 runs at the highest rate. Only the last stage (output at the host rate) needs the sharp filter.
+            const unsigned int stageOutputRatio = ratio >> (s + 1);
+            stages[s].Prepare( filterType,
+                               (s == nStages - 1) ? HalfBandDecimator::FILTER_QUALITY_HIGH : HalfBandDecimator::FILTER_QUALITY_STANDARD,
+                               maxBlockSize * stageOutputRatio );
+            latencyHostSamples += stages[s].GetLatencyInputSamples() / (float)(stageOutputRatio * 2);
+        }
+    }
+
+    //Latency introduced by the decimation cascade, in host rate samples (rounded, for reporting to the host).
+    int GetLatencySamples( void ) const { return (int)std::lround( latencyHostSamples ); }
+    float GetLatencySamplesExact( void ) const { return latencyHostSamples; }
+
+    /*
+     *  Render numSamples of host rate output (summed voices). Adds into output when addToOutput is set.
+     */
+    void RenderBlock( float* output, unsigned int numSamples, bool addToOutput = false )
+    {
+        const unsigned int ratio = GetOversamplingRatio();
+        unsigned int n = numSamples * ratio;
+        float* buffer = oversampledBuffer.data();
+
+        for( PeriodicOscillator* voice : periodicVoices )
+            voice->AdvanceGlide( n );
+
+        for( unsigned int i = 0; i < n; i++ ){
+            float sum = 0.0f;
+            for( SigGen* voice : voices )
+                sum += voice->getSample();
+            buffer[i] = sum;
+        }
+
+        for( HalfBandDecimator& stage : stages ){
+            n >>= 1;
+            stage.Process(buffer, buffer, n);
+        }
+
+        if( addToOutput )
+            juce::FloatVectorOperations::add(output, buffer, (int)numSamples);
+        else
+            juce::FloatVectorOperations::copy(output, buffer, (int)numSamples);
+    }
+
+private:
+    const unsigned int nStages;
+    const HalfBandDecimator::filter_type_t filterType;
+    std::vector<SigGen*> voices;
+    std::vector<PeriodicOscillator*> periodicVoices;
+    std::vector<HalfBandDecimator> stages;
+    std::vector<float> oversampledBuffer;
+    float latencyHostSamples = 0.0f;
+};
@@ -0,0 +1,319 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Scene Snapshots (Lock Free Scene Switching).
+ *
+ *  A scene is the level, frequency, mute state and sync ratio of every registered voice. Scenes are built off the audio
+ *  thread into immutable snapshots and kept in a library of MAX_SCENES slots, so recalling one is just an atomic pointer
+ *  publish: no slider callbacks, no live voice state touched from the message thread.
+ *
+ *  - RecallScene() publishes a stored snapshot. The audio thread picks it up in ProcessBlock() at the next block
+ *    boundary, copies the targets into preallocated arrays and applies them, either at once or crossfaded over a
+ *    number of samples (levels linearly, frequencies exponentially, updated once per block). Frequencies bypass the
+ *    voices' glide, so an instant switch is instant. Recalling during a crossfade starts a new crossfade from wherever
+ *    the voices are.
+ *  - Replaced or deleted snapshots are retired, then freed once the audio thread has started a block in a later epoch
+ *    (quiescent state based reclamation). The audio thread only dereferences a snapshot inside the ProcessBlock() that
+ *    loaded it, so that is the only grace period needed. Retired snapshots are collected by every writer call, or
+ *    explicitly with Collect(). If the audio callback isn't running they are held until it does (or until destruction).
+ *  - ProcessBlock() never locks or allocates. The writer side (Store/Recall/Delete/Collect) may be called from any
+ *    number of non audio threads; it is serialised with a CriticalSection.
+ *  - From RecallScene() until that switch (including its crossfade) has finished, the audio thread writes the voices'
+ *    level, frequency and mute, so nothing else may: whoever else controls them (e.g. the GUI) holds off while
+ *    OwnsVoices() is true. Attach the manager to SigGenEngine (SetSceneManager()) to have ProcessBlock() called.
+ *
+ *  Sync ratios: a synced voice's frequency is talkerFrequency * syncRatio, resolved when the snapshot is built.
+ *  Talkers themselves can't be synced (one level, as in the GUI).
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+
+class SceneManager
+{
+public:
+
+    typedef struct SceneVoice_S{
+        float level = 0.0f;
+        float frequency = 0.0f;     //Ignored for non periodic voices, and for synced voices.
+        bool muted = true;
+        int syncTalker = -1;        //Voice index of the talker, or -1 if not synced.
+        float syncRatio = 1.0f;
+    }scene_voice_t;
+
+    static constexpr unsigned int MAX_SCENES = 1024;
+    static constexpr unsigned int MAX_VOICES = 256;
+
+    //Immutable once built.
+    class Scene
+    {
+    public:
+        unsigned int GetNumVoices( void ) const { return (unsigned int)voices.size(); }
+        const scene_voice_t& GetVoice( unsigned int v ) const { return voices[v]; }
+        float GetResolvedFrequency( unsigned int v ) const { return frequencies[v]; }
+
+    private:
+        friend class SceneManager;
+        std::vector<scene_voice_t> voices;
+        std::vector<float> frequencies;     //Sync resolved
+    };
+
+    SceneManager(){}
+    ~SceneManager(){}
+
+    //Setup (before audio starts).
+    bool AddVoice( SigGen* voice ){ return AddVoice( voice, nullptr ); }
+    bool AddVoice( PeriodicOscillator* voice ){ return AddVoice( voice, voice ); }
+
+    unsigned int GetNumVoices( void ) const { return nVoices; }
+
+    //Call while the audio callback isn't running (e.g. from prepareToPlay).
+    void Prepare( double sampleRate )
+    {
+        fS = sampleRate;
+        crossfadeRemaining = 0;
+        crossfading.store( false, std::memory_order_relaxed );
+        finishedRecall.store( appliedRecall, std::memory_order_release );      //An abandoned crossfade hands the voices back
+    }
+
+    /*
+     *  Writer side (any thread but the audio thread).
+     */
+
+    //Builds a snapshot of numVoices voices (the rest are left alone when it's recalled) into slot, replacing any scene there.
+    bool StoreScene( unsigned int slot, const scene_voice_t* sceneVoices, unsigned int numVoices )
+    {
+        if( slot >= MAX_SCENES || numVoices > nVoices ){
+            printf("WARNING: Invalid Scene %u (%u voices)\r\n", slot, numVoices);
+            return false;
+        }
+
+        std::unique_ptr<Scene> scene( new Scene() );
+        scene->voices.assign( sceneVoices, sceneVoices + numVoices );
+        scene->frequencies.resize( numVoices );
+        for( unsigned int v = 0; v < numVoices; v++ ){
+            const scene_voice_t& voice = sceneVoices[v];
+            if( voice.syncTalker < 0 ){
+                scene->frequencies[v] = voice.frequency;
+                continue;
+            }
+            if( (unsigned int)voice.syncTalker >= numVoices || sceneVoices[voice.syncTalker].syncTalker >= 0 ){
+                printf("WARNING: Scene %u Voice %u Has An Invalid Sync Talker\r\n", slot, v);
+                return false;
+            }
+            scene->frequencies[v] = sceneVoices[voice.syncTalker].frequency * voice.syncRatio;
+        }
+
+        const juce::ScopedLock lock(writerLock);
+        Retire( std::move(library[slot]) );
+        library[slot] = std::move(scene);
+        Collect();
+        return true;
+    }
+
+    //Snapshot of the voices as they are now (absolute frequencies, no sync). Call from the thread that controls them.
+    bool CaptureScene( unsigned int slot )
+    {
+        if( OwnsVoices() ){
+            printf("WARNING: Scene %u Not Captured, A Scene Switch Is In Progress\r\n", slot);
+            return false;
+        }
+        std::vector<scene_voice_t> sceneVoices( nVoices );
+        for( unsigned int v = 0; v < nVoices; v++ ){
+            sceneVoices[v].level = voices[v]->GetAmplitude();
+            sceneVoices[v].muted = voices[v]->IsMuted();
+            sceneVoices[v].frequency = periodicVoices[v] ? periodicVoices[v]->GetFrequency() : 0.0f;
+        }
+        return StoreScene( slot, sceneVoices.data(), nVoices );
+    }
+
+    bool DeleteScene( unsigned int slot )
+    {
+        if( slot >= MAX_SCENES )
+            return false;
+        const juce::ScopedLock lock(writerLock);
+        Retire( std::move(library[slot]) );
+        Collect();
+        return true;
+    }
+
+    bool HasScene( unsigned int slot ) const
+    {
+        const juce::ScopedLock lock(writerLock);
+        return slot < MAX_SCENES && library[slot] != nullptr;
+    }
+
+    //Takes effect at the start of the next block. crossfadeSeconds = 0 switches instantly.
+    bool RecallScene( unsigned int slot, float crossfadeSeconds = 0.0f )
+    {
+        const juce::ScopedLock lock(writerLock);
+        if( slot >= MAX_SCENES || library[slot] == nullptr ){
+            printf("WARNING: Scene %u Not Stored\r\n", slot);
+            return false;
+        }
+        pendingCrossfadeSamples.store( (unsigned int)std::max( 0.0, crossfadeSeconds * fS ), std::memory_order_relaxed );
+        published.store( library[slot].get(), std::memory_order_release );
+        recallCount.fetch_add( 1, std::memory_order_release );
+        Collect();
+        return true;
+    }
+
+    //Frees every retired snapshot the audio thread can no longer be reading. Returns the number still waiting.
+    unsigned int Collect( void )
+    {
+        const juce::ScopedLock lock(writerLock);
+        const uint64_t quiescent = audioEpoch.load(std::memory_order_acquire);
+        retired.erase( std::remove_if( retired.begin(), retired.end(), [quiescent]( const retired_t& r ){ return r.epoch <= quiescent; } ),
+                       retired.end() );
+        return (unsigned int)retired.size();
+    }
+
+    bool IsCrossfading( void ) const { return crossfading.load(std::memory_order_relaxed); }
+
+    //True from RecallScene() until the audio thread has finished applying it (and every recall made since).
+    bool OwnsVoices( void ) const
+    {
+        return finishedRecall.load(std::memory_order_acquire) != recallCount.load(std::memory_order_acquire);
+    }
+
+    /*
+     *  Audio thread. Call once at the start of every block, before the voices render.
+     */
+    void ProcessBlock( unsigned int numSamples )
+    {
+        const uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+
+        const uint32_t recall = recallCount.load(std::memory_order_acquire);
+        if( recall != appliedRecall ){
+            appliedRecall = recall;
+            if( const Scene* scene = published.load(std::memory_order_acquire) )
+                BeginSwitch( *scene, pendingCrossfadeSamples.load(std::memory_order_relaxed) );
+            else if( crossfadeRemaining == 0 )
+                finishedRecall.store( appliedRecall, std::memory_order_release );      //Deleted before it was applied
+        }
+
+        if( crossfadeRemaining )
+            AdvanceCrossfade( numSamples );
+
+        audioEpoch.store( epoch, std::memory_order_release );      //Quiescent: nothing loaded in this block is referenced any more.
+    }
+
+private:
+    typedef struct Retired_S{
+        std::unique_ptr<Scene> scene;
+        uint64_t epoch;
+    }retired_t;
+
+    SigGen* voices[MAX_VOICES] = {};
+    PeriodicOscillator* periodicVoices[MAX_VOICES] = {};
+    unsigned int nVoices = 0;
+    double fS = 48000.0;
+
+    //Writer side
+    mutable juce::CriticalSection writerLock;
+    std::unique_ptr<Scene> library[MAX_SCENES];
+    std::vector<retired_t> retired;
+
+    //Publication
+    std::atomic<const Scene*> published { nullptr };
+    std::atomic<unsigned int> pendingCrossfadeSamples { 0 };
+    std::atomic<uint32_t> recallCount { 0 };
+    std::atomic<uint64_t> globalEpoch { 1 };
+    std::atomic<uint64_t> audioEpoch { 0 };
+    std::atomic<bool> crossfading { false };
+    std::atomic<uint32_t> finishedRecall { 0 };     //appliedRecall, once its switch has finished (see OwnsVoices())
+
+    //Audio thread. The switch targets are copied out of the snapshot, so it isn't referenced after the block.
+    uint32_t appliedRecall = 0;
+    unsigned int switchVoices = 0;
+    unsigned int crossfadeLength = 0, crossfadeRemaining = 0;
+    float fromLevel[MAX_VOICES] = {}, toLevel[MAX_VOICES] = {};
+    float fromFrequency[MAX_VOICES] = {}, toFrequency[MAX_VOICES] = {};
+    float frequencyLogRatio[MAX_VOICES] = {};
+    bool toMuted[MAX_VOICES] = {};
+
+    bool AddVoice( SigGen* voice, PeriodicOscillator* periodic )
+    {
+        if( nVoices >= MAX_VOICES ){
+            printf("WARNING: SceneManager Full\r\n");
+            return false;
+        }
+        voices[nVoices] = voice;
+        periodicVoices[nVoices] = periodic;
+        nVoices++;
+        return true;
+    }
+
+    //Writer lock held. The scene is unpublished first, so no block that starts in the new epoch can load it.
+    void Retire( std::unique_ptr<Scene> scene )
+    {
+        if( scene == nullptr )
+            return;
+        const Scene* expected = scene.get();
+        published.compare_exchange_strong( expected, nullptr );
+        const uint64_t epoch = globalEpoch.fetch_add( 1, std::memory_order_acq_rel ) + 1;
+        retired.push_back( { std::move(scene), epoch } );
+    }
+
+    void BeginSwitch( const Scene& scene, unsigned int crossfadeSamples )
+    {
+        switchVoices = scene.GetNumVoices();
+        for( unsigned int v = 0; v < switchVoices; v++ ){
+            SigGen* voice = voices[v];
+            toLevel[v] = scene.GetVoice(v).level;
+            toMuted[v] = scene.GetVoice(v).muted;
+            toFrequency[v] = scene.GetResolvedFrequency(v);
+            fromLevel[v] = voice->IsMuted() ? 0.0f : voice->GetAmplitude();
+            fromFrequency[v] = periodicVoices[v] ? periodicVoices[v]->GetCurrentFrequency() : 0.0f;      //Mid glide: where it has got to
+            frequencyLogRatio[v] = ( fromFrequency[v] > 0.0f && toFrequency[v] > 0.0f ) ? std::log( toFrequency[v] / fromFrequency[v] ) : 0.0f;
+
+            //Voices being unmuted fade up from silence.
+            if( crossfadeSamples && voice->IsMuted() && !toMuted[v] ){
+                voice->SetAmplitude(0.0f);
+                voice->Mute(false);
+            }
+        }
+
+        crossfadeLength = crossfadeRemaining = crossfadeSamples;
+        crossfading.store( crossfadeSamples > 0, std::memory_order_relaxed );
+        if( crossfadeSamples == 0 )
+            FinishSwitch();
+    }
+
+    //Targets are set for the end of the block; the voices' own amplitude ramp smooths the steps.
+    void AdvanceCrossfade( unsigned int numSamples )
+    {
+        crossfadeRemaining -= std::min( crossfadeRemaining, numSamples );
+        if( crossfadeRemaining == 0 ){
+            FinishSwitch();
+            return;
+        }
+
+        const float t = 1.0f - (float)crossfadeRemaining / (float)crossfadeLength;
+        for( unsigned int v = 0; v < switchVoices; v++ ){
+            SigGen* voice = voices[v];
+            if( !voice->IsMuted() )
+                voice->SetAmplitude( fromLevel[v] + t * ( (toMuted[v] ? 0.0f : toLevel[v]) - fromLevel[v] ) );
+            if( periodicVoices[v] && frequencyLogRatio[v] != 0.0f )
+                periodicVoices[v]->SetFrequencyWithoutGlide( fromFrequency[v] * std::exp( t * frequencyLogRatio[v] ) );
+        }
+    }
+
+    void FinishSwitch( void )
+    {
+        for( unsigned int v = 0; v < switchVoices; v++ ){
+            SigGen* voice = voices[v];
+            if( periodicVoices[v] )
+                periodicVoices[v]->SetFrequencyWithoutGlide( toFrequency[v] );      //Also stops any glide the voice was making
+            if( voice->IsMuted() != toMuted[v] )
+                voice->Mute( toMuted[v] );
+            voice->SetAmplitude( toLevel[v] );      //Sets the unmuted level of muted voices.
+        }
+        crossfadeRemaining = 0;
+        crossfading.store( false, std::memory_order_relaxed );
+        finishedRecall.store( appliedRecall, std::memory_order_release );      //Hands the voices back
+    }
+};
@@ -0,0 +1,325 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Shared Memory Output Stream.
+ *
+ *  Publishes every mixed block from SigGenEngine into a POSIX shared memory ring buffer, so analysis tools running as
+ *  separate processes can consume the generator output without going through the audio device.
+ *
+ *  Layout of the shared memory object:
+ *      [ SharedMemoryRingHeader (cache line aligned) | channel 0 ring | channel 1 ring | ... ]
+ *  Each channel ring holds capacityFrames floats (power of 2). Frame f of channel c lives at ring[c][f & (capacityFrames - 1)].
+ *
+ *  Single producer / multiple consumers, lock free:
+ *  - The writer bumps reserveFrame, writes the block, then publishes writeFrame (release) and increments blockSequence.
+ *  - Readers keep their own read position, read samples straight out of the mapping (no copy, no syscall),
+ *    then Validate() that the writer hasn't lapped them while they were reading (seqlock style).
+ *
+ *  POSIX only (Linux/macOS). On other platforms Open() returns false.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGenEngine.h"
+#include "stdio.h"
+
+#if ! JUCE_WINDOWS
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+typedef struct SharedMemoryRingHeader_S{
+    static constexpr uint32_t MAGIC = 0x53474E52;      //"SGNR"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numChannels;
+    uint32_t capacityFrames;        //Per channel, power of 2.
+    double sampleRate;
+
+    alignas(64) std::atomic<uint64_t> reserveFrame;     //End of the block currently being written.
+    std::atomic<uint64_t> writeFrame;                   //End of the last fully published block (total frames written).
+    std::atomic<uint64_t> blockSequence;                //Number of blocks published.
+}shared_memory_ring_header_t;
+
+static_assert( std::atomic<uint64_t>::is_always_lock_free, "Shared memory ring needs lock free 64-bit atomics" );
+
+//==============================================================================
+/*
+ *  Maps (and optionally creates) a named shared memory ring. Base for both ends.
+ */
+class SharedMemoryRing
+{
+public:
+    SharedMemoryRing(){}
+    virtual ~SharedMemoryRing(){ Unmap(); }
+
+    bool IsOpen( void ) const { return header != nullptr; }
+    unsigned int GetNumChannels( void ) const { return header ? header->numChannels : 0; }
+    unsigned int GetCapacityFrames( void ) const { return header ? header->capacityFrames : 0; }
+    double GetSampleRate( void ) const { return header ? header->sampleRate : 0.0; }
+
+protected:
+    shared_memory_ring_header_t* header = nullptr;
+    float* channelData = nullptr;
+    size_t mappedBytes = 0;
+
+    static size_t GetHeaderBytes( void ){ return (sizeof(shared_memory_ring_header_t) + 63) & ~(size_t)63; }
+    static size_t GetTotalBytes( unsigned int numChannels, unsigned int capacityFrames ){
+        return GetHeaderBytes() + (size_t)numChannels * capacityFrames * sizeof(float);
+    }
+
+    float* GetChannelRing( unsigned int channel ) const { return channelData + (size_t)channel * header->capacityFrames; }
+
+    bool Map( int fd, size_t bytes, bool writable )
+    {
+#if ! JUCE_WINDOWS
+        void* address = mmap( nullptr, bytes, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0 );
+        if( address == MAP_FAILED )
+            return false;
+        header = static_cast<shared_memory_ring_header_t*>(address);
+        channelData = reinterpret_cast<float*>( static_cast<char*>(address) + GetHeaderBytes() );
+        mappedBytes = bytes;
+        return true;
+#else
+        juce::ignoreUnused(fd, bytes, writable);
+        return false;
+#endif
+    }
+
+    void Unmap( void )
+    {
+#if ! JUCE_WINDOWS
+        if( header )
+            munmap( header, mappedBytes );
+#endif
+        header = nullptr;
+        channelData = nullptr;
+        mappedBytes = 0;
+    }
+};
+
+//==============================================================================
+/*
+ *  Producer end. Open/Close on the message thread, WriteBlock() from the audio thread.
+ *  Register with SigGenEngine::AddOutputTap() to publish every mixed block.
+ */
+class SharedMemoryOutputSink : public SharedMemoryRing,
+                               public SigGenOutputTap
+{
+public:
+    SharedMemoryOutputSink(){}
+    ~SharedMemoryOutputSink() override { Close(); }
+
+    //name must start with '/' (e.g. "/siggen_out"). capacityFrames is rounded up to a power of 2.
+    bool Open( const char* name, unsigned int numChannels, unsigned int capacityFrames, double sampleRate )
+    {
+        Close();
+#if ! JUCE_WINDOWS
+        capacityFrames = (unsigned int)juce::nextPowerOfTwo( (int)capacityFrames );
+        const size_t bytes = GetTotalBytes( numChannels, capacityFrames );
+
+        const int fd = shm_open( name, O_CREAT | O_RDWR, 0644 );
+        if( fd < 0 ){
+            printf("WARNING: shm_open(%s) failed\r\n", name);
+            return false;
+        }
+        const bool mapped = ( ftruncate( fd, (off_t)bytes ) == 0 ) && Map( fd, bytes, true );
+        close(fd);      //The mapping keeps the object alive.
+        if( !mapped ){
+            shm_unlink(name);
+            return false;
+        }
+
+        mlock( header, bytes );     //Best effort: keep the ring resident so the audio thread never page faults.
+        std::memset( static_cast<void*>(header), 0, bytes );
+
+        header->numChannels = numChannels;
+        header->capacityFrames = capacityFrames;
+        header->sampleRate = sampleRate;
+        header->reserveFrame.store(0, std::memory_order_relaxed);
+        header->writeFrame.store(0, std::memory_order_relaxed);
+        header->blockSequence.store(0, std::memory_order_relaxed);
+        header->version = shared_memory_ring_header_t::VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = shared_memory_ring_header_t::MAGIC;       //Readers check this last.
+
+        shmName = name;
+        return true;
+#else
+        juce::ignoreUnused(name, numChannels, capacityFrames, sampleRate);
+        return false;
+#endif
+    }
+
+    //Remove the sink from the engine (and let the callback finish) before closing.
+    void Close( void )
+    {
+        if( !IsOpen() )
+            return;
+        header->magic = 0;      //Tell readers the stream has gone.
+        Unmap();
+#if ! JUCE_WINDOWS
+        shm_unlink( shmName.c_str() );
+#endif
+        shmName.clear();
+    }
+
+    /*
+     *  Audio thread. Channels beyond the ring's channel count are ignored, missing channels are written as silence.
+     */
+    void WriteBlock( const juce::AudioBuffer<float>& buffer, int startSample, int numSamples )
+    {
+        if( !IsOpen() || numSamples <= 0 )
+            return;
+
+        if( (unsigned int)numSamples > header->capacityFrames ){       //Larger than the whole ring: publish in ring sized pieces.
+            for( int done = 0; done < numSamples; done += (int)header->capacityFrames )
+                WriteBlock( buffer, startSample + done, std::min( numSamples - done, (int)header->capacityFrames ) );
+            return;
+        }
+
+        const uint64_t start = header->writeFrame.load(std::memory_order_relaxed);     //Only this thread writes it.
+        const uint64_t end = start + (uint64_t)numSamples;
+        const unsigned int mask = header->capacityFrames - 1;
+        const unsigned int offset = (unsigned int)(start & mask);
+        const unsigned int firstPart = std::min( (unsigned int)numSamples, header->capacityFrames - offset );
+
+        header->reserveFrame.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for( unsigned int channel = 0; channel < header->numChannels; channel++ ){
+            float* ring = GetChannelRing(channel);
+            if( (int)channel < buffer.getNumChannels() ){
+                const float* source = buffer.getReadPointer( (int)channel, startSample );
+                std::memcpy( ring + offset, source, firstPart * sizeof(float) );
+                std::memcpy( ring, source + firstPart, ((unsigned int)numSamples - firstPart) * sizeof(float) );
+            }else{
+                std::memset( ring + offset, 0, firstPart * sizeof(float) );
+                std::memset( ring, 0, ((unsigned int)numSamples - firstPart) * sizeof(float) );
+            }
+        }
+
+        header->writeFrame.store(end, std::memory_order_release);
+        header->blockSequence.fetch_add(1, std::memory_order_release);
+    }
+
+    void ProcessOutputBlock( const juce::AudioBuffer<float>& buffer, int startSample, int numSamples ) override
+    {
+        WriteBlock( buffer, startSample, numSamples );
+    }
+
+private:
+    std::string shmName;
+};
+
+//==============================================================================
+/*
+ *  Consumer end. Any number of readers, in any number of processes.
+ *
+ *      reader.Open("/siggen_out");
+ *      while(...){
+ *          uint64_t available = reader.GetAvailableFrames();
+ *          SharedMemoryOutputReader::span_t span = reader.GetReadSpan(channel, n);   //Pointers into the ring, no copy
+ *          ...consume span.first / span.second...
+ *          if( reader.Validate() ) reader.Advance(n);  //else the writer lapped us mid-read: discard and resync.
+ *      }
+ */
+class SharedMemoryOutputReader : public SharedMemoryRing
+{
+public:
+    typedef struct Span_S{
+        const float* first = nullptr;
+        unsigned int firstLength = 0;
+        const float* second = nullptr;      //Non-null when the span wraps the end of the ring.
+        unsigned int secondLength = 0;
+    }span_t;
+
+    SharedMemoryOutputReader(){}
+    ~SharedMemoryOutputReader() override {}
+
+    bool Open( const char* name )
+    {
+        Unmap();
+#if ! JUCE_WINDOWS
+        const int fd = shm_open( name, O_RDONLY, 0 );
+        if( fd < 0 )
+            return false;
+
+        struct stat info;
+        const bool mapped = ( fstat( fd, &info ) == 0 ) && ( (size_t)info.st_size >= GetHeaderBytes() ) && Map( fd, (size_t)info.st_size, false );
+        close(fd);
+        if( !mapped )
+            return false;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if( header->magic != shared_memory_ring_header_t::MAGIC || header->version != shared_memory_ring_header_t::VERSION
+            || GetTotalBytes( header->numChannels, header->capacityFrames ) > mappedBytes ){
+            Unmap();
+            return false;
+        }
+
+        readFrame = header->writeFrame.load(std::memory_order_acquire);     //Start from "now".
+        return true;
+#else
+        juce::ignoreUnused(name);
+        return false;
+#endif
+    }
+
+    //False once the writer has closed the stream.
+    bool IsWriterAlive( void ) const { return IsOpen() && header->magic == shared_memory_ring_header_t::MAGIC; }
+
+    uint64_t GetReadFrame( void ) const { return readFrame; }
+    uint64_t GetBlockSequence( void ) const { return header->blockSequence.load(std::memory_order_acquire); }
+    uint64_t GetDroppedFrames( void ) const { return droppedFrames; }
+
+    //Frames ready to read. If the writer has lapped this reader, skips forward (counted in GetDroppedFrames()).
+    uint64_t GetAvailableFrames( void )
+    {
+        const uint64_t written = header->writeFrame.load(std::memory_order_acquire);
+        const uint64_t reserved = header->reserveFrame.load(std::memory_order_relaxed);
+        const uint64_t oldestSafe = reserved > header->capacityFrames ? reserved - header->capacityFrames : 0;
+        if( readFrame < oldestSafe ){
+            droppedFrames += oldestSafe - readFrame;
+            readFrame = oldestSafe;
+        }
+        return written - readFrame;
+    }
+
+    span_t GetReadSpan( unsigned int channel, unsigned int numFrames ) const
+    {
+        span_t span;
+        if( channel >= header->numChannels )
+            return span;
+
+        const float* ring = GetChannelRing(channel);
+        const unsigned int offset = (unsigned int)(readFrame & (header->capacityFrames - 1));
+        span.first = ring + offset;
+        span.firstLength = std::min( numFrames, header->capacityFrames - offset );
+        if( span.firstLength < numFrames ){
+            span.second = ring;
+            span.secondLength = numFrames - span.firstLength;
+        }
+        return span;
+    }
+
+    //Call after consuming a span: true if the writer can't have overwritten it while it was being read.
+    bool Validate( void ) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t reserved = header->reserveFrame.load(std::memory_order_relaxed);
+        return readFrame + header->capacityFrames >= reserved;
+    }
+
+    void Advance( unsigned int numFrames ){ readFrame += numFrames; }
+
+private:
+    uint64_t readFrame = 0;
+    uint64_t droppedFrames = 0;
+};
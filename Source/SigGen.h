@@ -18,7 +18,8 @@ class SigGen{
 public:
     
     SigGen(){
-        SigGenList[instance_count++] = this;
+        if( instance_count < MAX_N_SIGNALS )    //Only the first MAX_N_SIGNALS are indexed. Large voice counts (e.g. benchmarks) are still valid.
+            SigGenList[instance_count++] = this;
     }
     virtual ~SigGen(){}
     
@@ -56,6 +57,11 @@ public:
         }
     }
     
+    bool IsMuted( void ) const { return muted; }
+    
+    //The level set by SetAmplitude(), whether or not muted.
+    float GetAmplitude( void ) const { return muted ? unmutedAmplitude : targetAmplitude; }
+    
     static SigGen* GetInstance( unsigned int n ){
         //TODO: Assert for n >= instance_count;
         //TODO: Assert for n >= MAX_N_SIGNALS
@@ -81,6 +87,28 @@ protected:
         }
     }
     
+    //Block version of UpdateAmplitude() + scale, for generators that render a block at a time.
+    void ApplyAmplitude( float* dest, unsigned int numSamples )
+    {
+        if( rampRemainingSamples == 0 ){
+            juce::FloatVectorOperations::multiply( dest, amplitude, (int)numSamples );
+            return;
+        }
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            UpdateAmplitude();
+            dest[n] *= amplitude;
+        }
+    }
+    
+    //sin(pi.x) for x in [-1, 1]. Folded to [-0.5, 0.5], then a degree 11 odd Taylor polynomial (error < 1e-7). Branch free, so block loops vectorise.
+    static inline float SinPi( float x )
+    {
+        x = x > 0.5f ? 1.0f - x : x;
+        x = x < -0.5f ? -1.0f - x : x;
+        const float x2 = x * x;
+        return x * (3.14159265f + x2 * (-5.16771278f + x2 * (2.55016404f + x2 * (-0.599264529f + x2 * (0.0821458866f + x2 * -0.00737043095f)))));
+    }
+    
 private:
     
     constexpr inline void SetTargetAmplitude( const float value ){
@@ -122,27 +150,159 @@ public:
         fS = rate;
     }
     
-    void SetFrequency(float f)
+    /*
+     *  The target is published atomically and applied by the audio thread in AdvanceGlide() at the start of its next
+     *  block, so it can be called from any one thread. With a glide time set, the phase increment then ramps
+     *  exponentially (constant ratio per sample) from its current value to the new one over that time; without one it
+     *  jumps. Publishing a new target cancels any glide in progress.
+     *  Voices rendered outside SigGenEngine (and its groups) must call AdvanceGlide() themselves.
+     */
+    virtual void SetFrequency(float f)
     {
-        cyclesPerSample = f / (float)fS;
-        angleDelta = cyclesPerSample * TWO_PI;
-//        printf("SetFreq: CyclesPerSample = %f, angleDelta = %f\r\n", cyclesPerSample, angleDelta);
+        PublishFrequency( f, glideSeconds.load(std::memory_order_relaxed) * fS );
+    }
+    
+    //As SetFrequency(), but always jumps (e.g. scene recalls), whatever the glide time.
+    void SetFrequencyWithoutGlide( float f ){ PublishFrequency( f, 0.0f ); }
+    
+    //Control side: the target frequency, i.e. the last one set (where a glide is heading).
+    float GetFrequency( void ) const { return cyclesPerSample * fS; }
+    
+    //Audio thread: the frequency actually being rendered (part way through a glide, this is where it has got to).
+    float GetCurrentFrequency( void ) const { return angleDelta * fS * (1.0f / TWO_PI); }
+    
+    //Portamento time for subsequent SetFrequency() calls. 0 = off.
+    void SetGlideTime( float seconds ){ glideSeconds.store( std::max( 0.0f, seconds ), std::memory_order_relaxed ); }
+    float GetGlideTime( void ) const { return glideSeconds.load(std::memory_order_relaxed); }
+    bool IsGliding( void ) const {
+        const bool glidePending = pendingAngleDelta.load(std::memory_order_relaxed) >= 0.0f && pendingGlideSamples.load(std::memory_order_relaxed) >= 1.0f;
+        return glidePending || glideRemainingSamples.load(std::memory_order_relaxed) != 0;
+    }
+    
+    /*
+     *  Audio thread: call once at the start of each block, before rendering it (SigGenEngine, OversampledVoiceGroup and
+     *  CrossModulationGroup do this for their voices). A newly published target starts its glide here (one log).
+     *  The increment is held for the block and stepped by exp(glideLogStep * numSamples) between blocks; that factor is
+     *  only recalculated when the glide or the block size changes, so a glide costs one multiply per block and nothing
+     *  per sample. All glide state below is only touched here.
+     */
+    void AdvanceGlide( unsigned int numSamples )
+    {
+        const float target = pendingAngleDelta.exchange( -1.0f, std::memory_order_acquire );
+        if( target >= 0.0f )
+            StartGlide( target, pendingGlideSamples.load(std::memory_order_relaxed) );
+        
+        unsigned int glideRemaining = glideRemainingSamples.load(std::memory_order_relaxed);
+        if( glideRemaining == 0 )
+            return;
+        
+        if( numSamples >= glideRemaining ){      //Land exactly on the target.
+            glideRemainingSamples.store( 0, std::memory_order_relaxed );
+            SetAngleDelta( targetAngleDelta );
+            return;
+        }
+        
+        if( numSamples != glideBlockSize ){
+            glideBlockFactor = std::exp( glideLogStep * (float)numSamples );
+            glideBlockSize = numSamples;
+        }
+        glideRemainingSamples.store( glideRemaining - numSamples, std::memory_order_relaxed );
+        SetAngleDelta( angleDelta * glideBlockFactor );
     }
     
     void updateAngle()
     {
         currentAngle += angleDelta;
         if (currentAngle >= TWO_PI)
-            currentAngle = 0;
+            currentAngle -= TWO_PI;     //Keep the remainder, otherwise every cycle is cut short and the output runs sharp.
+    }
+    
+    /*
+     *  Block render with per-sample phase modulation (see CrossModulationGroup). Either input may be null.
+     *  fm is added to the phase increment (radians/sample), pm to the output phase (radians).
+     *  This default suits any oscillator whose CalcSample() only depends on currentAngle.
+     */
+    virtual void RenderModulatedBlock( float* dest, const float* fm, const float* pm, unsigned int numSamples )
+    {
+        AdvancePhase( dest, fm, pm, numSamples );
+        
+        const float angle = currentAngle, delta = angleDelta;
+        angleDelta = 0.0f;
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            UpdateAmplitude();
+            currentAngle = dest[n];
+            dest[n] = CalcSample();
+        }
+        currentAngle = angle;
+        angleDelta = delta;
     }
     
 protected:
     float fS = 48000;       //default to 48K.
-    float cyclesPerSample;
+    float cyclesPerSample = 0.0f;
     float currentAngle = 0.0, angleDelta = 0.0;
     
+    //Every change to angleDelta goes through here, so oscillators with derived state (e.g. QuadratureOscillator) can follow it.
+    virtual void SetAngleDelta( float delta ){ angleDelta = delta; }
+    
+    /*
+     *  Writes the phase of each output sample (wrapped to [0, 2pi)) and advances currentAngle past the block.
+     *  The accumulation is serial, but it's one add per sample; the waveform itself is then shaped as a block.
+     */
+    void AdvancePhase( float* phase, const float* fm, const float* pm, unsigned int numSamples )
+    {
+        float angle = currentAngle;
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            phase[n] = angle;
+            angle += fm ? angleDelta + fm[n] : angleDelta;
+            if( angle >= TWO_PI || angle < 0.0f )       //Deep FM can step more than a cycle, or backwards.
+                angle -= TWO_PI * std::floor( angle * (1.0f / TWO_PI) );
+        }
+        currentAngle = angle;
+        
+        if( pm == nullptr )
+            return;
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            const float p = phase[n] + pm[n];
+            phase[n] = p - TWO_PI * std::floor( p * (1.0f / TWO_PI) );
+        }
+    }
+    
 private:
-
+    //Control side -> audio thread
+    std::atomic<float> glideSeconds { 0.0f };
+    std::atomic<float> pendingAngleDelta { -1.0f };         //< 0: nothing pending
+    std::atomic<float> pendingGlideSamples { 0.0f };
+    
+    //Audio thread (AdvanceGlide)
+    float targetAngleDelta = 0.0f;
+    float glideLogStep = 0.0f;              //log(target / start) per sample
+    float glideBlockFactor = 1.0f;          //exp(glideLogStep * glideBlockSize)
+    unsigned int glideBlockSize = 0;
+    std::atomic<unsigned int> glideRemainingSamples { 0 };  //Atomic only so IsGliding() can be polled.
+    
+    void PublishFrequency( float f, float glideSamples )
+    {
+        cyclesPerSample = f / (float)fS;
+//        printf("SetFreq: CyclesPerSample = %f\r\n", cyclesPerSample);
+        pendingGlideSamples.store( glideSamples, std::memory_order_relaxed );
+        pendingAngleDelta.store( cyclesPerSample * TWO_PI, std::memory_order_release );
+    }
+    
+    //From/to 0Hz there is no exponential path, so those (and glides shorter than a sample) jump.
+    void StartGlide( float target, float glideSamples )
+    {
+        targetAngleDelta = target;
+        if( glideSamples < 1.0f || angleDelta <= 0.0f || target <= 0.0f ){
+            glideRemainingSamples.store( 0, std::memory_order_relaxed );
+            SetAngleDelta( target );
+            return;
+        }
+        
+        glideLogStep = std::log( target / angleDelta ) / glideSamples;
+        glideBlockSize = 0;         //Block factor is recalculated below.
+        glideRemainingSamples.store( (unsigned int)glideSamples, std::memory_order_relaxed );
+    }
 };
 
 class SineWaveOscillator : public PeriodicOscillator
@@ -158,6 +318,15 @@ public:
         return amplitude * currentSample;
     }
     
+    //Polynomial sine over the whole block: sin(angle) = -sin(pi.x), x = angle / pi - 1 in [-1, 1).
+    void RenderModulatedBlock( float* dest, const float* fm, const float* pm, unsigned int numSamples ) override
+    {
+        AdvancePhase( dest, fm, pm, numSamples );
+        for( unsigned int n = 0; n < numSamples; n++ )
+            dest[n] = -SinPi( dest[n] * (1.0f / PI) - 1.0f );
+        ApplyAmplitude( dest, numSamples );
+    }
+    
 private:
 
 };
@@ -177,5 +346,160 @@ public:
         return sample;
     }
     
+    void RenderModulatedBlock( float* dest, const float* fm, const float* pm, unsigned int numSamples ) override
+    {
+        AdvancePhase( dest, fm, pm, numSamples );
+        for( unsigned int n = 0; n < numSamples; n++ )
+            dest[n] = dest[n] >= PI ? -0.5f : 0.5f;
+        ApplyAmplitude( dest, numSamples );
+    }
+    
+private:
+};
+
+/*
+ *  Quadrature (I/Q) Oscillator.
+ *
+ *  Rather than two std::sin() calls per sample, a unit phasor z = (re, im) is rotated by w = e^(j*angleDelta)
+ *  with one complex multiply per sample. I = Re{z}, Q = Im{z}.
+ *  Rounding errors slowly change |z|, so it is renormalised once per block with a cheap Newton step (no sqrt).
+ *
+ *  RenderBlock() computes PHASOR_LANES samples at a time from precomputed powers of w (z[n+k] = z[n] * w^k),
+ *  so the inner loop has no serial dependency and auto-vectorises. Call it per oscillator to accumulate many
+ *  oscillators into the same I/Q mix buffers.
+ */
+class QuadratureOscillator : public PeriodicOscillator
+{
+public:
+    QuadratureOscillator(){ SetAngleDelta(0.0f); }       //Fills the rotation steps (0Hz until a frequency is applied).
+    ~QuadratureOscillator(){}
+
+    //Returns I. The matching Q sample is available from GetQuadratureSample() until the next call.
+    float CalcSample() override
+    {
+        const float re = phasorRe, im = phasorIm;
+        phasorRe = re * stepRe[1] - im * stepIm[1];
+        phasorIm = re * stepIm[1] + im * stepRe[1];
+
+        if( ++samplesSinceRenormalise >= RENORMALISE_INTERVAL )
+            Renormalise();
+
+        lastQ = amplitude * im;
+        return amplitude * re;
+    }
+
+    float GetQuadratureSample( void ) const { return lastQ; }
+
+    /*
+     *  I only. The phasor itself is modulated: each sample it is rotated by e^(j(angleDelta + fm)), and the output is
+     *  Re(z.e^(j.pm)), with the rotations from the SinPi polynomial. No transcendental calls, so it's as cheap per
+     *  sample in a feedback loop (called a sample at a time) as over a block.
+     */
+    void RenderModulatedBlock( float* dest, const float* fm, const float* pm, unsigned int numSamples ) override
+    {
+        float re = phasorRe, im = phasorIm;
+        float rotRe = stepRe[1], rotIm = stepIm[1];
+        for( unsigned int n = 0; n < numSamples; n++ ){
+            if( pm ){
+                float pmSin, pmCos;
+                SinCos( pm[n], pmSin, pmCos );
+                dest[n] = re * pmCos - im * pmSin;
+            }else{
+                dest[n] = re;
+            }
+
+            if( fm )
+                SinCos( angleDelta + fm[n], rotIm, rotRe );
+            const float nextRe = re * rotRe - im * rotIm;
+            im = re * rotIm + im * rotRe;
+            re = nextRe;
+        }
+        phasorRe = re;
+        phasorIm = im;
+        Renormalise();
+
+        ApplyAmplitude( dest, numSamples );
+    }
+
+    /*
+     *  Render (or accumulate, if addToOutput) numSamples of I and Q into separate channel buffers.
+     */
+    void RenderBlock( float* outI, float* outQ, int numSamples, bool addToOutput = false )
+    {
+        int n = 0;
+        float gain[PHASOR_LANES];
+
+        for( ; n + (int)PHASOR_LANES <= numSamples; n += PHASOR_LANES ){
+            for( unsigned int k = 0; k < PHASOR_LANES; k++ ){     //Amplitude ramp is scalar, but trivial.
+                UpdateAmplitude();
+                gain[k] = amplitude;
+            }
+
+            const float re = phasorRe, im = phasorIm;
+            for( unsigned int k = 0; k < PHASOR_LANES; k++ ){     //Independent lanes, vectorises.
+                const float i = gain[k] * (re * stepRe[k] - im * stepIm[k]);
+                const float q = gain[k] * (re * stepIm[k] + im * stepRe[k]);
+                outI[n + k] = addToOutput ? outI[n + k] + i : i;
+                outQ[n + k] = addToOutput ? outQ[n + k] + q : q;
+            }
+
+            phasorRe = re * stepRe[PHASOR_LANES] - im * stepIm[PHASOR_LANES];
+            phasorIm = re * stepIm[PHASOR_LANES] + im * stepRe[PHASOR_LANES];
+        }
+
+        for( ; n < numSamples; n++ ){       //Tail
+            UpdateAmplitude();
+            const float i = CalcSample();
+            outI[n] = addToOutput ? outI[n] + i : i;
+            outQ[n] = addToOutput ? outQ[n] + lastQ : lastQ;
+        }
+
+        Renormalise();
+    }
+
 private:
+    static constexpr unsigned int PHASOR_LANES = 8;
+    static constexpr unsigned int RENORMALISE_INTERVAL = 256;
+
+    float phasorRe = 1.0f, phasorIm = 0.0f;
+    float stepRe[PHASOR_LANES + 1], stepIm[PHASOR_LANES + 1];
+    float lastQ = 0.0f;
+    unsigned int samplesSinceRenormalise = 0;
+
+    /*
+     *  Rotation powers w^0 ... w^(PHASOR_LANES), accumulated in double so the per-sample step is as exact as float allows.
+     *  One sin/cos pair, so it's also cheap enough to run every block of a glide.
+     */
+    void SetAngleDelta( float delta ) override
+    {
+        PeriodicOscillator::SetAngleDelta(delta);
+
+        const double wRe = std::cos( (double)delta ), wIm = std::sin( (double)delta );
+        double re = 1.0, im = 0.0;
+        for( unsigned int k = 0; k <= PHASOR_LANES; k++ ){
+            stepRe[k] = (float)re;
+            stepIm[k] = (float)im;
+            const double nextRe = re * wRe - im * wIm;
+            im = re * wIm + im * wRe;
+            re = nextRe;
+        }
+    }
+
+    //sin and cos of any angle (radians), from SinPi.
+    static inline void SinCos( float angle, float& sine, float& cosine )
+    {
+        float x = angle * (1.0f / PI);
+        x -= 2.0f * std::floor( (x + 1.0f) * 0.5f );       //[-1, 1)
+        sine = SinPi( x );
+        const float y = x + 0.5f;                           //cos(pi.x) = sin(pi(x + 0.5))
+        cosine = SinPi( y >= 1.0f ? y - 2.0f : y );
+    }
+
+    //|z| stays very close to 1, so 1/sqrt(|z|^2) ~= (3 - |z|^2) / 2 (one Newton step) is plenty.
+    inline void Renormalise( void ){
+        const float g = 0.5f * (3.0f - (phasorRe * phasorRe + phasorIm * phasorIm));
+        phasorRe *= g;
+        phasorIm *= g;
+        samplesSinceRenormalise = 0;
+    }
 };
@@ -0,0 +1,433 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Headless Signal Generator Engine (Mixer).
+ *
+ *  Owns no GUI state, so the same mixer runs inside MainContentComponent and in the headless benchmark.
+ *  Voices are owned elsewhere and registered here as "sources". Every block:
+ *  0) If a SceneManager is attached, it applies any newly recalled scene (or steps a crossfade) to its voices.
+ *  1) Each source renders one block into its own buffer (voices sample by sample, voice groups and cross modulation
+ *     groups as a block). Frequency glides are stepped once per block, beforehand.
+ *     If an event processor is attached, the block is rendered in segments split at its event offsets.
+ *  2) The N sources x M channels routing matrix is applied with vectorised multiply-accumulates.
+ *     Zero gain routes are skipped entirely. Channels with no routes are cleared once, and channels with the
+ *     same routing as an earlier channel are copied from it rather than mixed again.
+ *
+ *  By default every source is routed to every channel at unity gain (i.e. the same mono mix on all channels).
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+#include "Oversampler.h"
+#include "CrossModulation.h"
+#include "SceneManager.h"
+
+/*
+ *  Receives every mixed block at the end of getNextAudioBlock (audio thread). e.g. the shared memory output stream.
+ */
+class SigGenOutputTap
+{
+public:
+    virtual ~SigGenOutputTap(){}
+    virtual void ProcessOutputBlock( const juce::AudioBuffer<float>& buffer, int startSample, int numSamples ) = 0;
+};
+
+/*
+ *  Sample accurate control (e.g. MIDI). Called on the audio thread at the start of each block; the engine then renders
+ *  up to each returned offset, and asks the processor to apply the events due there, and so on until the end of the block.
+ */
+class SigGenEventProcessor
+{
+public:
+    virtual ~SigGenEventProcessor(){}
+    virtual void BeginBlock( unsigned int numSamples ) = 0;
+    //Apply every event due at or before sampleOffset. Returns the offset of the next pending event (>= numSamples if none).
+    virtual unsigned int ApplyEventsAt( unsigned int sampleOffset ) = 0;
+};
+
+//==============================================================================
+class SigGenEngine : public juce::AudioSource
+{
+public:
+    static constexpr unsigned int MAX_OUTPUT_CHANNELS = 64;
+    static constexpr unsigned int MAX_OUTPUT_TAPS = 4;
+
+    SigGenEngine(){}
+    ~SigGenEngine() override {}
+
+    //Returns the source index, used for routing.
+    unsigned int AddVoice( SigGen* voice ){
+        return AddSource( SOURCE_TYPE_VOICE, voice, nullptr );
+    }
+
+    //Periodic voices have their sample rate set in prepareToPlay().
+    unsigned int AddVoice( PeriodicOscillator* voice ){
+        periodicVoices.push_back(voice);
+        return AddSource( SOURCE_TYPE_VOICE, voice, nullptr );
+    }
+
+    //Adds two sources: I (returned index) and Q (returned index + 1), so they can be routed to separate channels.
+    unsigned int AddQuadratureVoice( QuadratureOscillator* voice ){
+        periodicVoices.push_back(voice);
+        const unsigned int index = AddSource( SOURCE_TYPE_QUADRATURE_I, voice, nullptr );
+        AddSource( SOURCE_TYPE_QUADRATURE_Q, voice, nullptr );
+        return index;
+    }
+
+    unsigned int AddVoiceGroup( OversampledVoiceGroup* group ){
+        voiceGroups.push_back(group);
+        return AddSource( SOURCE_TYPE_VOICE_GROUP, nullptr, group );
+    }
+
+    //Adds one source per operator (returned index + operator index), so carriers and modulators can be routed separately.
+    //Add the operators to the group before calling this.
+    unsigned int AddModulationGroup( CrossModulationGroup* group ){
+        modulationGroups.push_back(group);
+        const unsigned int index = AddSource( SOURCE_TYPE_MODULATION_GROUP, nullptr, nullptr, group );
+        for( unsigned int op = 1; op < group->GetNumOperators(); op++ )
+            AddSource( SOURCE_TYPE_MODULATION_OPERATOR, nullptr, nullptr, group );
+        return index;
+    }
+
+    unsigned int GetNumSources( void ) const { return (unsigned int)sources.size(); }
+
+    /*
+     *  Output taps can be added/removed while running (lock free). After RemoveOutputTap() the tap may still be in use
+     *  by the current callback, so don't destroy it until the audio device has stopped (or a block has passed).
+     */
+    bool AddOutputTap( SigGenOutputTap* tap )
+    {
+        for( auto& slot : outputTaps ){
+            SigGenOutputTap* expected = nullptr;
+            if( slot.compare_exchange_strong(expected, tap) )
+                return true;
+        }
+        return false;
+    }
+
+    //One event processor at a time. nullptr to remove.
+    void SetEventProcessor( SigGenEventProcessor* processor ){ eventProcessor.store(processor, std::memory_order_release); }
+
+    //One scene manager at a time, nullptr to remove. Its voices should also be registered here as normal.
+    void SetSceneManager( SceneManager* manager ){ sceneManager.store(manager, std::memory_order_release); }
+
+    void RemoveOutputTap( SigGenOutputTap* tap )
+    {
+        for( auto& slot : outputTaps ){
+            SigGenOutputTap* expected = tap;
+            slot.compare_exchange_strong(expected, nullptr);
+        }
+    }
+
+    //Worst case latency of any voice group, in samples. Ungrouped voices have none.
+    int GetLatencySamples( void ) const
+    {
+        int latency = 0;
+        for( const OversampledVoiceGroup* group : voiceGroups )
+            latency = std::max(latency, group->GetLatencySamples());
+        return latency;
+    }
+
+    /*
+     *  Routing. Call from one control thread at a time (e.g. the message thread), after every source has been added.
+     *  Each call edits a private copy of the matrix and publishes the whole of it in one step, so the audio thread only
+     *  ever sees complete routings (an exclusive route never drops its source for a block). It picks up the latest
+     *  one at the next block.
+     */
+    void SetRouteGain( unsigned int source, unsigned int channel, float gain )
+    {
+        WriteRouteGain( source, channel, gain );
+        PublishRoutes();
+    }
+
+    float GetRouteGain( unsigned int source, unsigned int channel ) const
+    {
+        if( source >= sources.size() || channel >= MAX_OUTPUT_CHANNELS )
+            return 0.0f;
+        return routingMatrix[source * MAX_OUTPUT_CHANNELS + channel];
+    }
+
+    void RouteSourceToAllChannels( unsigned int source, float gain = 1.0f )
+    {
+        WriteSourceRoutes( source, gain );
+        PublishRoutes();
+    }
+
+    //Exclusive: removes any other routes for this source.
+    void RouteSourceToChannel( unsigned int source, unsigned int channel, float gain = 1.0f )
+    {
+        WriteSourceRoutes( source, 0.0f );
+        WriteRouteGain( source, channel, gain );
+        PublishRoutes();
+    }
+
+    //Exclusive, constant power pan between firstChannel (pan = -1) and firstChannel + 1 (pan = +1).
+    void RouteSourceToChannelPair( unsigned int source, unsigned int firstChannel, float gain = 1.0f, float pan = 0.0f )
+    {
+        static constexpr float QUARTER_PI = 3.141592653589793238L * 0.25;
+        pan = juce::jlimit(-1.0f, 1.0f, pan);
+        WriteSourceRoutes( source, 0.0f );
+        WriteRouteGain( source, firstChannel,     gain * std::cos( (pan + 1.0f) * QUARTER_PI ) );
+        WriteRouteGain( source, firstChannel + 1, gain * std::sin( (pan + 1.0f) * QUARTER_PI ) );
+        PublishRoutes();
+    }
+
+    void prepareToPlay( int samplesPerBlockExpected, double sampleRate ) override
+    {
+        for( PeriodicOscillator* voice : periodicVoices )
+            voice->SetSampleRate( (float)sampleRate );
+
+        for( OversampledVoiceGroup* group : voiceGroups )
+            group->Prepare( sampleRate, (unsigned int)samplesPerBlockExpected );
+
+        for( CrossModulationGroup* group : modulationGroups )
+            group->Prepare( sampleRate, (unsigned int)samplesPerBlockExpected );
+
+        if( SceneManager* scenes = sceneManager.load(std::memory_order_acquire) )
+            scenes->Prepare( sampleRate );
+
+        maxBlockSize = (unsigned int)samplesPerBlockExpected;
+        sourceBuffers.assign( sources.size() * maxBlockSize, 0.0f );
+        routesBuilt = false;
+    }
+
+    void getNextAudioBlock( const juce::AudioSourceChannelInfo& bufferToFill ) override
+    {
+        if( maxBlockSize == 0 ){        //Not prepared.
+            bufferToFill.clearActiveBufferRegion();
+            return;
+        }
+
+        if( publishedRouting.load(std::memory_order_relaxed) & ROUTING_NEW ){
+            audioRouting = publishedRouting.exchange( audioRouting, std::memory_order_acq_rel ) & ~ROUTING_NEW;
+            routesBuilt = false;
+        }
+        if( !routesBuilt ){
+            RebuildActiveRoutes();
+            routesBuilt = true;
+        }
+
+        unsigned int start = 0;
+        unsigned int numSamplesRemaining = (unsigned int)bufferToFill.numSamples;
+
+        //Devices may deliver larger blocks than requested. Split them rather than allocate on the audio thread.
+        while( numSamplesRemaining ){
+            const unsigned int n = std::min(numSamplesRemaining, maxBlockSize);
+            RenderBlock( bufferToFill, (unsigned int)bufferToFill.startSample + start, n );
+            start += n;
+            numSamplesRemaining -= n;
+        }
+
+        for( auto& slot : outputTaps ){
+            if( SigGenOutputTap* tap = slot.load(std::memory_order_acquire) )
+                tap->ProcessOutputBlock( *bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples );
+        }
+    }
+
+    void releaseResources() override {}
+
+private:
+
+    typedef enum{
+        SOURCE_TYPE_VOICE,
+        SOURCE_TYPE_QUADRATURE_I,       //Renders both I and Q (into the next source's buffer).
+        SOURCE_TYPE_QUADRATURE_Q,       //Rendered by the preceding I source.
+        SOURCE_TYPE_VOICE_GROUP,
+        SOURCE_TYPE_MODULATION_GROUP,       //Renders every operator of the group (into this and the following sources' buffers).
+        SOURCE_TYPE_MODULATION_OPERATOR,    //Rendered by the group's first source.
+    }source_type_t;
+
+    typedef struct Source_S{
+        source_type_t type;
+        SigGen* voice;
+        OversampledVoiceGroup* group;
+        CrossModulationGroup* modulation;
+    }source_t;
+
+    typedef struct Route_S{
+        unsigned int source;
+        unsigned int channel;
+        float gain;
+    }route_t;
+
+    std::vector<source_t> sources;
+    std::vector<PeriodicOscillator*> periodicVoices;
+    std::vector<OversampledVoiceGroup*> voiceGroups;
+    std::vector<CrossModulationGroup*> modulationGroups;
+
+    /*
+     *  Routing triple buffer: the control thread edits routingMatrix, copies it into its own slot and swaps that slot
+     *  into publishedRouting (flagged ROUTING_NEW); the audio thread swaps its slot for a new published one. Every slot
+     *  is only ever touched by one side, so nothing is read while it's being written.
+     */
+    static constexpr unsigned int ROUTING_NEW = 0x4;
+    std::vector<float> routingMatrix;           //[source][MAX_OUTPUT_CHANNELS], control side
+    std::vector<float> routingSlots[3];
+    std::atomic<unsigned int> publishedRouting { 1 };
+    unsigned int editRouting = 0, audioRouting = 2;
+    bool routesBuilt = false;                   //Audio side
+    std::vector<route_t> activeRoutes;          //Non-zero routes, sorted by channel. Capacity reserved up front.
+    int channelCopyOf[MAX_OUTPUT_CHANNELS] = {};
+    bool channelRouted[MAX_OUTPUT_CHANNELS] = {};
+
+    std::atomic<SigGenOutputTap*> outputTaps[MAX_OUTPUT_TAPS] = {};
+    std::atomic<SigGenEventProcessor*> eventProcessor { nullptr };
+    std::atomic<SceneManager*> sceneManager { nullptr };
+
+    std::vector<float> sourceBuffers;           //[source][maxBlockSize]
+    unsigned int maxBlockSize = 0;
+
+    unsigned int AddSource( source_type_t type, SigGen* voice, OversampledVoiceGroup* group, CrossModulationGroup* modulation = nullptr )
+    {
+        const unsigned int index = (unsigned int)sources.size();
+        sources.push_back( { type, voice, group, modulation } );
+        routingMatrix.resize( sources.size() * MAX_OUTPUT_CHANNELS, 0.0f );
+        for( std::vector<float>& slot : routingSlots )
+            slot.resize( routingMatrix.size(), 0.0f );
+        activeRoutes.reserve( sources.size() * MAX_OUTPUT_CHANNELS );
+        RouteSourceToAllChannels( index );
+        return index;
+    }
+
+    void WriteRouteGain( unsigned int source, unsigned int channel, float gain )
+    {
+        if( source >= sources.size() || channel >= MAX_OUTPUT_CHANNELS )
+            return;
+        routingMatrix[source * MAX_OUTPUT_CHANNELS + channel] = gain;
+    }
+
+    void WriteSourceRoutes( unsigned int source, float gain )
+    {
+        for( unsigned int channel = 0; channel < MAX_OUTPUT_CHANNELS; channel++ )
+            WriteRouteGain( source, channel, gain );
+    }
+
+    //Control thread.
+    void PublishRoutes( void )
+    {
+        std::copy( routingMatrix.begin(), routingMatrix.end(), routingSlots[editRouting].begin() );
+        editRouting = publishedRouting.exchange( editRouting | ROUTING_NEW, std::memory_order_acq_rel ) & ~ROUTING_NEW;
+    }
+
+    float* GetSourceBuffer( unsigned int source ){ return sourceBuffers.data() + source * maxBlockSize; }
+
+    /*
+     *  Audio thread. Only ever fills the reserved capacity, so no allocation.
+     *  A channel whose matrix column matches an earlier channel is just a copy of it (e.g. the default mono mix on every channel).
+     */
+    void RebuildActiveRoutes( void )
+    {
+        const unsigned int nSources = (unsigned int)sources.size();
+        const float* matrix = routingSlots[audioRouting].data();
+        activeRoutes.clear();
+
+        for( unsigned int channel = 0; channel < MAX_OUTPUT_CHANNELS; channel++ ){
+            channelCopyOf[channel] = -1;
+            channelRouted[channel] = false;
+            for( unsigned int source = 0; source < nSources; source++ )
+                channelRouted[channel] |= matrix[source * MAX_OUTPUT_CHANNELS + channel] != 0.0f;
+            if( !channelRouted[channel] )
+                continue;
+
+            for( unsigned int earlier = 0; earlier < channel && channelCopyOf[channel] < 0; earlier++ ){
+                if( !channelRouted[earlier] || channelCopyOf[earlier] >= 0 )
+                    continue;
+                bool identical = true;
+                for( unsigned int source = 0; source < nSources && identical; source++ )
+                    identical = matrix[source * MAX_OUTPUT_CHANNELS + channel] == matrix[source * MAX_OUTPUT_CHANNELS + earlier];
+                if( identical )
+                    channelCopyOf[channel] = (int)earlier;
+            }
+            if( channelCopyOf[channel] >= 0 )
+                continue;
+
+            for( unsigned int source = 0; source < nSources; source++ ){
+                const float gain = matrix[source * MAX_OUTPUT_CHANNELS + channel];
+                if( gain != 0.0f )
+                    activeRoutes.push_back( { source, channel, gain } );
+            }
+        }
+    }
+
+    void RenderSources( unsigned int offset, unsigned int numSamples )
+    {
+        for( PeriodicOscillator* voice : periodicVoices )
+            voice->AdvanceGlide( numSamples );
+
+        for( unsigned int s = 0; s < sources.size(); s++ ){
+            const source_t& source = sources[s];
+            float* dest = GetSourceBuffer(s) + offset;
+
+            switch( source.type ){
+                case SOURCE_TYPE_VOICE:
+                    for( unsigned int sample = 0; sample < numSamples; ++sample )
+                        dest[sample] = source.voice->getSample();
+                    break;
+                case SOURCE_TYPE_QUADRATURE_I:
+                    static_cast<QuadratureOscillator*>(source.voice)->RenderBlock( dest, GetSourceBuffer(s + 1) + offset, (int)numSamples );
+                    break;
+                case SOURCE_TYPE_QUADRATURE_Q:
+                    break;
+                case SOURCE_TYPE_VOICE_GROUP:
+                    source.group->RenderBlock( dest, numSamples );
+                    break;
+                case SOURCE_TYPE_MODULATION_GROUP:
+                    source.modulation->RenderBlock( dest, maxBlockSize, numSamples );
+                    break;
+                case SOURCE_TYPE_MODULATION_OPERATOR:
+                    break;
+            }
+        }
+    }
+
+    void RenderBlock( const juce::AudioSourceChannelInfo& bufferToFill, unsigned int startSample, unsigned int numSamples )
+    {
+        //0) Scene switches. Before any glide is stepped, so the new frequencies apply from the start of this block.
+        if( SceneManager* scenes = sceneManager.load(std::memory_order_acquire) )
+            scenes->ProcessBlock( numSamples );
+
+        //1) Render Sources. Split at event offsets so control changes (e.g. MIDI) land on the exact sample.
+        SigGenEventProcessor* processor = eventProcessor.load(std::memory_order_acquire);
+        unsigned int position = 0;
+        unsigned int nextEvent = numSamples;
+        if( processor ){
+            processor->BeginBlock( numSamples );
+            nextEvent = processor->ApplyEventsAt( 0 );
+        }
+
+        while( position < numSamples ){
+            const unsigned int segmentEnd = std::min( std::max( nextEvent, position + 1 ), numSamples );
+            RenderSources( position, segmentEnd - position );
+            position = segmentEnd;
+            if( processor && position < numSamples )
+                nextEvent = processor->ApplyEventsAt( position );
+        }
+
+        //2) Apply Routing Matrix. Routes are sorted by channel, so the first route into a channel overwrites and the rest accumulate.
+        const unsigned int numChannels = std::min( (unsigned int)bufferToFill.buffer->getNumChannels(), MAX_OUTPUT_CHANNELS );
+        int lastChannel = -1;
+        for( const route_t& route : activeRoutes ){
+            if( route.channel >= numChannels )
+                break;
+
+            float* out = bufferToFill.buffer->getWritePointer( (int)route.channel, (int)startSample );
+            if( (int)route.channel != lastChannel )
+                juce::FloatVectorOperations::copyWithMultiply( out, GetSourceBuffer(route.source), route.gain, (int)numSamples );
+            else
+                juce::FloatVectorOperations::addWithMultiply( out, GetSourceBuffer(route.source), route.gain, (int)numSamples );
+            lastChannel = (int)route.channel;
+        }
+
+        //3) Duplicate channels are copied, unrouted channels are cleared.
+        for( unsigned int channel = 0; channel < (unsigned int)bufferToFill.buffer->getNumChannels(); channel++ ){
+            float* out = bufferToFill.buffer->getWritePointer( (int)channel, (int)startSample );
+            if( channel >= MAX_OUTPUT_CHANNELS || !channelRouted[channel] )
+                juce::FloatVectorOperations::clear( out, (int)numSamples );
+            else if( channelCopyOf[channel] >= 0 )
+                juce::FloatVectorOperations::copy( out, bufferToFill.buffer->getReadPointer( channelCopyOf[channel], (int)startSample ), (int)numSamples );
+        }
+    }
+};
@@ -31,7 +31,7 @@
 
  dependencies:     juce_audio_basics, juce_audio_devices, juce_audio_formats,
                    juce_audio_processors, juce_audio_utils, juce_core,
-                   juce_data_structures, juce_events, juce_graphics,
+                   juce_data_structures, juce_dsp, juce_events, juce_graphics,
                    juce_gui_basics, juce_gui_extra
  exporters:        xcode_mac, vs2019, linux_make
 
@@ -55,9 +55,18 @@
 
 #include "GUI_Components.h"
 #include "SigGen.h"
+#include "SigGenEngine.h"
+#include "SharedMemoryOutput.h"
+#include "OutputRecorder.h"
+#include "MidiVoiceController.h"
+#include "LatencyMeter.h"
+#include "ToneMeter.h"
+#include "ChirpGenerator.h"
+#include "SceneManager.h"
 
 //==============================================================================
-class MainContentComponent   :  public juce::AudioAppComponent
+class MainContentComponent   :  public juce::AudioAppComponent,
+                                private juce::Timer
 //                                public juce::Button::Listener,
 //                                public juce::Slider::Listener
 {
@@ -65,50 +74,152 @@ public:
     MainContentComponent()
     {
         addAndMakeVisible (&GUI_TopScene);     //Add Top Level, Parent Scene for the GUI
-
+        
+        /*
+         * Attach Audio Objects to GUI Objects
+         */
+        GUI_TopScene.AttachAudioComponentToGuiComponent(&WhiteNoise_0, 0);
+        engine.AddVoice(&WhiteNoise_0);
+        
+        for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++ ){
+            GUI_TopScene.AttachPeriodicAudioComponentToGuiComponent(&SineOscs[sine_osc_n], sine_osc_n + 1);
+            engine.AddVoice(&SineOscs[sine_osc_n]);
+        }
+        
+        engine.AddOutputTap(&sharedMemoryOutput);
+        engine.AddOutputTap(&outputRecorder);
+        
+        /*
+         * MIDI: Notes play a dedicated pool of voices, CCs control the GUI voices (through their controls, from the timer).
+         */
+        for (unsigned int voice_n = 0; voice_n < N_MIDI_VOICES; voice_n++){
+            engine.AddVoice(&MidiVoices[voice_n]);
+            midiController.AddPoolVoice(&MidiVoices[voice_n]);
+        }
+        for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++){
+            midiController.WatchController(MIDI_CC_SINE_AMPLITUDE_BASE + sine_osc_n);
+            midiController.WatchController(MIDI_CC_SINE_MUTE_BASE + sine_osc_n);
+        }
+        engine.SetEventProcessor(&midiController);
+        OpenMidiInputs();
+        
+        /*
+         * Latency Measurement: replaces the output with an MLS while running. Loop an output back to input 0.
+         */
+        latencyButton.setButtonText("Latency Test");
+        latencyButton.setClickingTogglesState(true);
+        latencyButton.onClick = [this] { ToggleLatencyMeasurement(latencyButton.getToggleState()); };
+        addAndMakeVisible(&latencyButton);
+        addAndMakeVisible(&latencyLabel);
+        
+        /*
+         * Tone Meter: level and phase of input 0 at each sine voice's frequency (follows the GUI, including sync listeners).
+         */
+        for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++)
+            toneMeter.AddTone(&SineOscs[sine_osc_n]);
+        addAndMakeVisible(&toneLabel);
+        startTimerHz(TIMER_HZ);
+        
+        /*
+         * Sweep: one shot exponential chirp, started from the button. Settings are (re)applied in prepareToPlay.
+         */
+        engine.AddVoice(&Sweep);
+        sweepButton.setButtonText("Sweep");
+        sweepButton.onClick = [this] { Sweep.Start(); };
+        addAndMakeVisible(&sweepButton);
+        
+        /*
+         * Scenes: the GUI voices. Click a scene button to recall it (crossfaded), shift-click to store the voices into it.
+         * Scene switches are applied by the engine on the audio thread, and the GUI voice controls are locked until they finish.
+         */
+        sceneManager.AddVoice(&WhiteNoise_0);
+        for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++)
+            sceneManager.AddVoice(&SineOscs[sine_osc_n]);
+        engine.SetSceneManager(&sceneManager);
+        for (unsigned int scene_n = 0; scene_n < N_SCENE_BUTTONS; scene_n++){
+            sceneButtons[scene_n].setButtonText("Scene " + juce::String(scene_n + 1));
+            sceneButtons[scene_n].onClick = [this, scene_n] { SceneButtonClicked(scene_n); };
+            addAndMakeVisible(&sceneButtons[scene_n]);
+        }
+        
+        /*
+         * Record: the converted (integer, dithered) mix to a WAV file, from the output tap. Click again to stop.
+         */
+        recordButton.setButtonText("Record");
+        recordButton.setClickingTogglesState(true);
+        recordButton.onClick = [this] { ToggleRecording(recordButton.getToggleState()); };
+        addAndMakeVisible(&recordButton);
+        
+        /*
+         * Start audio last: prepareToPlay() and the audio thread use everything registered above.
+         */
         // Some platforms require permissions to open input channels so request that here
         if (juce::RuntimePermissions::isRequired (juce::RuntimePermissions::recordAudio)
             && ! juce::RuntimePermissions::isGranted (juce::RuntimePermissions::recordAudio))
         {
             juce::RuntimePermissions::request (juce::RuntimePermissions::recordAudio,
-                                               [&] (bool granted) { setAudioChannels (granted ? 2 : 0, 2); });
+                                               [&] (bool granted) { setAudioChannels (granted ? N_INPUT_CHANNELS : 0, N_OUTPUT_CHANNELS); });
         }
         else
         {
             // Specify the number of input and output channels that we want to open
-            setAudioChannels (0, 2);
-        }
-        
-        /*
-         * Attach Audio Objects to GUI Objects
-         */
-        GUI_TopScene.AttachAudioComponentToGuiComponent(&WhiteNoise_0, 0);
-        
-        for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++ ){
-            GUI_TopScene.AttachPeriodicAudioComponentToGuiComponent(&SineOscs[sine_osc_n], sine_osc_n + 1);
+            setAudioChannels (N_INPUT_CHANNELS, N_OUTPUT_CHANNELS);
         }
     }
 
     ~MainContentComponent() override
     {
         printf("\r\nSHUTTING DOWN\r\n");
+        stopTimer();
+        for (auto& input : midiInputs)
+            input->stop();
+        latencyMeter.Stop();
         shutdownAudio();
+        outputRecorder.Stop();
+        engine.SetEventProcessor(nullptr);
+        engine.SetSceneManager(nullptr);
+        engine.RemoveOutputTap(&sharedMemoryOutput);
+        engine.RemoveOutputTap(&outputRecorder);
     }
 
-    void prepareToPlay (int, double sampleRate) override
+    void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
     {
         printf("\r\nPrepare To Play: SR = %f\r\n", sampleRate);
         
         //TODO: Set (or update) SampleRate For All Oscillators
         WhiteNoise_0.Mute(true);                    //Init Muted.
         WhiteNoise_0.SetAmplitude(0.1);             //Init Level.
-        setSize (1560, 512);
+        setSize (1560, 512 + TONE_BAR_HEIGHT + LATENCY_BAR_HEIGHT);
+        
+        engine.prepareToPlay(samplesPerBlockExpected, sampleRate);      //Sets the Sample Rate for all Periodic Oscillators
+        midiController.SetSampleRate(sampleRate);
+        
+        const bool wasMeasuring = latencyMeter.IsRunning();
+        latencyMeter.Prepare(sampleRate);                               //Stops it
+        if (wasMeasuring)
+            latencyMeter.Start();
+        toneMeter.Prepare(sampleRate);
+        
+        ChirpGenerator::sweep_settings_t sweepSettings;
+        sweepSettings.type = ChirpGenerator::SWEEP_EXPONENTIAL;
+        sweepSettings.startHz = 20.0;
+        sweepSettings.endHz = std::min(20000.0, sampleRate * 0.45);
+        sweepSettings.seconds = 10.0;
+        sweepSettings.fadeSeconds = 0.05;
+        Sweep.SetSampleRate(sampleRate);
+        Sweep.SetSweep(sweepSettings);
+        Sweep.SetAmplitude(0.1f);
+        
+        //(Re)Open the Shared Memory Output Stream at the new Sample Rate. The audio callback isn't running during prepareToPlay.
+        if( !sharedMemoryOutput.Open(SHARED_MEMORY_OUTPUT_NAME, N_OUTPUT_CHANNELS, SHARED_MEMORY_OUTPUT_RING_FRAMES, sampleRate) )
+            printf("WARNING: Shared Memory Output Unavailable\r\n");
         
         static const float Base_Hz = 440.0;
         for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++){
             SineOscs[sine_osc_n].Mute(true);
-            SineOscs[sine_osc_n].SetSampleRate( sampleRate );
+            SineOscs[sine_osc_n].SetGlideTime(0.0f);               //Start on Base_Hz, then glide from there.
             SineOscs[sine_osc_n].SetFrequency(Base_Hz);
+            SineOscs[sine_osc_n].SetGlideTime(SINE_GLIDE_SECONDS);
             SineOscs[sine_osc_n].SetAmplitude(0.1);
         }
         
@@ -117,28 +228,36 @@ public:
 
     void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
     {
-        auto numSamplesRemaining = bufferToFill.numSamples;
+        //Input must be read before the engine writes the (shared) buffer.
+        const float* input = bufferToFill.buffer->getNumChannels() > 0 ? bufferToFill.buffer->getReadPointer(0, bufferToFill.startSample) : nullptr;
+        const bool measuring = latencyMeter.CaptureInput(input, (unsigned int)bufferToFill.numSamples);
+        if (input != nullptr)
+            toneMeter.ProcessBlock(input, (unsigned int)bufferToFill.numSamples);
         
-        for (auto sample = 0; sample < numSamplesRemaining; ++sample)
-        {
-            //TODO: Sum and Mix all Generated Signals
-            float output = WhiteNoise_0.getSample();
-            for( unsigned int osc_n = 0; osc_n < N_SINE_WAVE_OSCS; osc_n++){
-                output+= SineOscs[osc_n].getSample();
-            }
-            
-            for (auto channel = 0; channel < bufferToFill.buffer->getNumChannels(); ++channel){
-                bufferToFill.buffer->setSample (channel, sample, output);
-            }
-        }
+        engine.getNextAudioBlock(bufferToFill);     //Sum and Mix all Generated Signals
+        
+        if (measuring)
+            latencyMeter.WriteStimulus(bufferToFill.buffer->getArrayOfWritePointers(), (unsigned int)bufferToFill.buffer->getNumChannels(),
+                                       (unsigned int)bufferToFill.startSample, (unsigned int)bufferToFill.numSamples);
     }
 
-    void releaseResources() override {}
+    void releaseResources() override
+    {
+        engine.releaseResources();
+    }
 
     void resized() override     //Called whenever the GUI Window is resized (including Initialization)
     {
         //Redraw GUI Window over MainComponent Window
-        GUI_TopScene.setBounds(0, 0, getWidth(), getHeight());
+        GUI_TopScene.setBounds(0, 0, getWidth(), getHeight() - TONE_BAR_HEIGHT - LATENCY_BAR_HEIGHT);
+        toneLabel.setBounds(4, getHeight() - TONE_BAR_HEIGHT - LATENCY_BAR_HEIGHT, getWidth() - 8, TONE_BAR_HEIGHT);
+        latencyButton.setBounds(4, getHeight() - LATENCY_BAR_HEIGHT + 2, 120, LATENCY_BAR_HEIGHT - 4);
+        sweepButton.setBounds(128, getHeight() - LATENCY_BAR_HEIGHT + 2, 80, LATENCY_BAR_HEIGHT - 4);
+        for (unsigned int scene_n = 0; scene_n < N_SCENE_BUTTONS; scene_n++)
+            sceneButtons[scene_n].setBounds(212 + 74 * (int)scene_n, getHeight() - LATENCY_BAR_HEIGHT + 2, 70, LATENCY_BAR_HEIGHT - 4);
+        recordButton.setBounds(212 + 74 * (int)N_SCENE_BUTTONS, getHeight() - LATENCY_BAR_HEIGHT + 2, 70, LATENCY_BAR_HEIGHT - 4);
+        const int latencyLabelX = 288 + 74 * (int)N_SCENE_BUTTONS;
+        latencyLabel.setBounds(latencyLabelX, getHeight() - LATENCY_BAR_HEIGHT, getWidth() - latencyLabelX - 4, LATENCY_BAR_HEIGHT);
     }
 
     void resetParameters()
@@ -146,11 +265,176 @@ public:
     }
     
 private:
+    void ToggleLatencyMeasurement(bool start)
+    {
+        if (start && latencyMeter.Start())
+            return;
+        latencyMeter.Stop();
+        latencyButton.setToggleState(false, juce::dontSendNotification);
+        UpdateLatencyLabel();       //Leave the final result on screen
+    }
+    
+    void ToggleRecording(bool start)
+    {
+        if (!start){
+            outputRecorder.Stop();
+            printf("Recording Stopped: %llu frames dropped, %llu samples clipped\r\n",
+                   (unsigned long long)outputRecorder.GetDroppedFrames(), (unsigned long long)outputRecorder.GetClipCount());
+            return;
+        }
+        
+        juce::AudioIODevice* device = deviceManager.getCurrentAudioDevice();
+        const juce::File file = juce::File::getSpecialLocation(juce::File::userMusicDirectory)
+                                    .getChildFile("SigGen " + juce::Time::getCurrentTime().formatted("%Y-%m-%d %H-%M-%S") + ".wav");
+        if (device == nullptr || !outputRecorder.Start(file, N_OUTPUT_CHANNELS, device->getCurrentSampleRate(), RECORD_FORMAT, RECORD_DITHER)){
+            recordButton.setToggleState(false, juce::dontSendNotification);
+            return;
+        }
+        printf("Recording To %s\r\n", file.getFullPathName().toRawUTF8());
+    }
+    
+    void SceneButtonClicked(unsigned int scene)
+    {
+        if (juce::ModifierKeys::currentModifiers.isShiftDown()){
+            if (sceneManager.CaptureScene(scene))
+                sceneButtons[scene].setColour(juce::TextButton::ColourIds::buttonColourId, juce::Colours::darkturquoise);
+            return;
+        }
+        
+        //Locked before the recall: from then on the audio thread owns the voices. Unlocked by the timer once it's finished.
+        GUI_TopScene.SetVoiceControlsEnabled(false);
+        sceneOwnsVoices = true;
+        sceneManager.RecallScene(scene, SCENE_CROSSFADE_SECONDS);
+    }
+    
+    void timerCallback() override
+    {
+        if (sceneOwnsVoices && !sceneManager.OwnsVoices()){
+            sceneOwnsVoices = false;
+            GUI_TopScene.RefreshVoiceControls();
+            GUI_TopScene.SetVoiceControlsEnabled(true);
+        }
+        ApplyMidiControllers();
+        if (latencyMeter.IsRunning())
+            UpdateLatencyLabel();
+        UpdateToneLabel();
+    }
+    
+    //The GUI sine voices are only ever written from the message thread, so CCs move their controls rather than the voices.
+    //While a scene switch owns the voices, CCs are left latched until it has finished.
+    void ApplyMidiControllers()
+    {
+        if (sceneOwnsVoices)
+            return;
+        
+        for (unsigned int sine_osc_n = 0; sine_osc_n < N_SINE_WAVE_OSCS; sine_osc_n++){
+            const int level = midiController.TakeControllerValue(MIDI_CC_SINE_AMPLITUDE_BASE + sine_osc_n);
+            if (level != MidiVoiceController::NO_CONTROLLER_VALUE)
+                GUI_TopScene.SetVoiceLevelNormalised(sine_osc_n + 1, (float)level / 127.0f);
+            
+            const int mute = midiController.TakeControllerValue(MIDI_CC_SINE_MUTE_BASE + sine_osc_n);
+            if (mute != MidiVoiceController::NO_CONTROLLER_VALUE)
+                GUI_TopScene.SetVoiceMuted(sine_osc_n + 1, mute >= 64);
+        }
+    }
+    
+    void UpdateToneLabel()
+    {
+        ToneMeter::tone_result_t results[N_SINE_WAVE_OSCS];
+        const unsigned int nResults = toneMeter.GetResults(results, N_SINE_WAVE_OSCS);
+        
+        juce::String text = "Input 1 tones:";
+        for (unsigned int n = 0; n < nResults; n++){
+            if (SineOscs[n].IsMuted())
+                continue;
+            text += "   " + juce::String(results[n].frequency, 1) + " Hz " + juce::String(results[n].levelDb, 1) + " dB "
+                  + juce::String(results[n].phaseDegrees, 0) + " deg";
+        }
+        toneLabel.setText(text, juce::dontSendNotification);
+    }
+    
+    void UpdateLatencyLabel()
+    {
+        const LatencyMeter::latency_report_t report = latencyMeter.GetReport();
+        juce::String text;
+        if (!report.signalPresent)
+            text = "No input signal (loop an output back to input 1)";
+        else if (report.latencySamples < 0)
+            text = "Measuring...";
+        else
+            text = "Round trip " + juce::String(report.latencySamples) + " samples (" + juce::String(report.latencyMs, 2) + " ms)"
+                 + (report.inverted ? ", inverted" : "");
+        text += "   Glitches: " + juce::String(report.glitches) + "   Latency changes: " + juce::String(report.latencyChanges);
+        if (report.lastGlitchSeconds >= 0.0)
+            text += "   Last glitch at " + juce::String(report.lastGlitchSeconds, 2) + " s";
+        latencyLabel.setText(text, juce::dontSendNotification);
+    }
+    
+    void OpenMidiInputs()
+    {
+        //Virtual port (not available on Windows). Useful for routing from a DAW, or for loopback testing.
+        if (auto virtualInput = juce::MidiInput::createNewDevice(MIDI_VIRTUAL_INPUT_NAME, &midiController))
+            midiInputs.push_back(std::move(virtualInput));
+        else
+            printf("WARNING: Virtual MIDI Input Unavailable\r\n");
+        
+        //Plus any hardware inputs. All feed the same controller.
+        for (auto& device : juce::MidiInput::getAvailableDevices()){
+            if (auto input = juce::MidiInput::openDevice(device.identifier, &midiController))
+                midiInputs.push_back(std::move(input));
+        }
+        
+        for (auto& input : midiInputs)
+            input->start();
+    }
+    
+
     SceneComponent GUI_TopScene;            //Absolute Top Level Scene for the Main Content Component
     
     static const unsigned int N_SINE_WAVE_OSCS = 9;
     WhiteNoiseGen WhiteNoise_0;
     SineWaveOscillator SineOscs[N_SINE_WAVE_OSCS];
+    static constexpr float SINE_GLIDE_SECONDS = 0.05f;     //Frequency glide of the GUI sine voices (slider/automation changes)
+    
+    ChirpGenerator Sweep;
+    
+    static const unsigned int N_MIDI_VOICES = 8;
+    SineWaveOscillator MidiVoices[N_MIDI_VOICES];
+    
+    SigGenEngine engine;                    //Headless Mixer. Voices above are registered in the constructor.
+    static const int N_OUTPUT_CHANNELS = 2;
+    static constexpr const char* SHARED_MEMORY_OUTPUT_NAME = "/siggen_out";     //Local processes can read the mixed output from here (see Tools/SharedMemoryReaderMain.cpp)
+    static const unsigned int SHARED_MEMORY_OUTPUT_RING_FRAMES = 65536;
+    SharedMemoryOutputSink sharedMemoryOutput;
+    static constexpr const char* MIDI_VIRTUAL_INPUT_NAME = "SigGen MIDI In";    //Other apps (or a loopback test) can send MIDI to this port
+    static const int MIDI_CC_SINE_AMPLITUDE_BASE = 21;                          //CC 21..29 -> SineOscs[0..8] Amplitude
+    static const int MIDI_CC_SINE_MUTE_BASE = 31;                               //CC 31..39 -> SineOscs[0..8] Mute
+    static const int TIMER_HZ = 25;                                             //Label updates and MIDI CC polling
+    MidiVoiceController midiController;
+    std::vector<std::unique_ptr<juce::MidiInput>> midiInputs;
+    
+    static const int N_INPUT_CHANNELS = 2;     //Only used by the latency measurement (input 0)
+    static const int LATENCY_BAR_HEIGHT = 28;
+    LatencyMeter latencyMeter;
+    juce::TextButton latencyButton;
+    juce::Label latencyLabel;
+    
+    static const int TONE_BAR_HEIGHT = 24;
+    ToneMeter toneMeter;
+    juce::Label toneLabel;
+    
+    juce::TextButton sweepButton;
+    
+    static const unsigned int N_SCENE_BUTTONS = 4;
+    static constexpr float SCENE_CROSSFADE_SECONDS = 0.5f;
+    SceneManager sceneManager;
+    juce::TextButton sceneButtons[N_SCENE_BUTTONS];
+    bool sceneOwnsVoices = false;           //Message thread: GUI voice controls are locked
+    
+    static const OutputConverter::sample_format_t RECORD_FORMAT = OutputConverter::FORMAT_INT24;
+    static const OutputConverter::dither_t RECORD_DITHER = OutputConverter::DITHER_TPDF;
+    OutputRecorder outputRecorder;
+    juce::TextButton recordButton;
     
     static const unsigned int N_SIG_GENS = 2; //TODO: There should be a Config Class that contains N_SIG Gens etc... so it can be reference by GUI and Audio System
   
@@ -0,0 +1,206 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Per-Tone Level and Phase Meter (Goertzel Bank).
+ *
+ *  Measures level and phase at exactly the frequencies a set of PeriodicOscillators are producing, rather than at FFT
+ *  bin centres. Each tracked oscillator gets one Goertzel resonator, so the cost is O(tones) per sample, independent of
+ *  frequency resolution.
+ *
+ *  - The input is Hann windowed over consecutive (non overlapping) measurement windows. Frequencies are latched from
+ *    the oscillators at the start of every window, so they follow GUI changes and sync group listeners automatically.
+ *    The latch reads the frequency being rendered (so during a glide, where it has got to rather than its target),
+ *    which is owned by the audio thread: run the meter on the thread that renders the oscillators.
+ *  - The bank is stored structure-of-arrays and padded to TONE_LANES, so the per-sample update is one fixed width loop
+ *    across tones that the compiler vectorises. State is double: a float Goertzel coefficient is too coarse at low
+ *    frequencies (the resonance drifts by ~1e-7 / sin(w) rad/sample).
+ *  - Resolution is set by the window: tones closer than ~4 / window (40Hz at the default 0.1s) leak into each other.
+ *  - Level is the sine peak amplitude in dBFS (same scale as SigGen::SetAmplitude). Phase is that of a sine, referenced
+ *    to the meter's first sample, so it is stable while the frequency is.
+ *  - Results are published seqlock style through atomics: GetResults() is safe from any thread, never blocks the audio
+ *    thread, and never returns a half written window.
+ *
+ *  Feed it with ProcessBlock() (e.g. captured input), or register it as an engine output tap to meter the mix.
+ */
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SigGen.h"
+#include "SigGenEngine.h"
+
+class ToneMeter : public SigGenOutputTap
+{
+public:
+
+    typedef struct ToneResult_S{
+        float frequency;
+        float levelDb;          //dBFS, sine peak
+        float phaseDegrees;     //-180..180
+    }tone_result_t;
+
+    static constexpr unsigned int MAX_TONES = 64;
+    static constexpr unsigned int TONE_LANES = 8;
+    static constexpr float DEFAULT_WINDOW_SECONDS = 0.1f;
+
+    ToneMeter()
+    {
+        //std::atomic's default constructor leaves the value uninitialised before C++20.
+        for( unsigned int k = 0; k < MAX_TONES; k++ ){
+            resultFrequency[k].store( 0.0f, std::memory_order_relaxed );
+            resultLevelDb[k].store( 0.0f, std::memory_order_relaxed );
+            resultPhase[k].store( 0.0f, std::memory_order_relaxed );
+        }
+    }
+    ~ToneMeter() override {}
+
+    //Setup (before audio starts).
+    bool AddTone( PeriodicOscillator* oscillator )
+    {
+        if( nTones >= MAX_TONES ){
+            printf("WARNING: ToneMeter Full\r\n");
+            return false;
+        }
+        oscillators[nTones++] = oscillator;
+        nLanes = (nTones + TONE_LANES - 1) / TONE_LANES * TONE_LANES;
+        return true;
+    }
+
+    //Channel used when registered as an output tap.
+    void SetTapChannel( int channel ){ tapChannel = channel; }
+
+    //Allocates. Call while the audio callback isn't running (e.g. from prepareToPlay).
+    void Prepare( double sampleRate, float windowSeconds = DEFAULT_WINDOW_SECONDS )
+    {
+        fS = sampleRate;
+        windowLength = std::max( 2u, (unsigned int)(windowSeconds * sampleRate) );
+        window.resize(windowLength);
+        windowGain = 0.0;
+        for( unsigned int n = 0; n < windowLength; n++ ){
+            window[n] = 0.5f - 0.5f * std::cos( juce::MathConstants<float>::twoPi * (float)n / (float)windowLength );
+            windowGain += window[n];
+        }
+        windowPosition = 0;
+        windowStartFrame = 0;
+    }
+
+    unsigned int GetNumTones( void ) const { return nTones; }
+    double GetWindowSeconds( void ) const { return windowLength / fS; }
+    uint32_t GetWindowCount( void ) const { return sequence.load(std::memory_order_acquire) / 2; }
+
+    //Any thread. Returns the number of results written (the most recent complete window), 0 before the first window.
+    unsigned int GetResults( tone_result_t* results, unsigned int maxResults ) const
+    {
+        const unsigned int count = std::min( nTones, maxResults );
+        uint32_t before, after;
+        do{
+            before = sequence.load(std::memory_order_acquire);
+            if( before < 2 )
+                return 0;
+            for( unsigned int k = 0; k < count; k++ ){
+                results[k].frequency    = resultFrequency[k].load(std::memory_order_relaxed);
+                results[k].levelDb      = resultLevelDb[k].load(std::memory_order_relaxed);
+                results[k].phaseDegrees = resultPhase[k].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        }while( (before & 1u) || before != after );
+        return count;
+    }
+
+    //Audio thread.
+    void ProcessBlock( const float* samples, unsigned int numSamples )
+    {
+        if( nTones == 0 || windowLength == 0 )
+            return;
+
+        unsigned int n = 0;
+        while( n < numSamples ){
+            if( windowPosition == 0 )
+                LatchFrequencies();
+
+            const unsigned int length = std::min( numSamples - n, windowLength - windowPosition );
+            const float* w = window.data() + windowPosition;
+            for( unsigned int m = 0; m < length; m++ ){
+                const double x = (double)(samples[n + m] * w[m]);
+                for( unsigned int k = 0; k < nLanes; k++ ){
+                    const double s0 = x + coeff[k] * s1[k] - s2[k];
+                    s2[k] = s1[k];
+                    s1[k] = s0;
+                }
+            }
+            windowPosition += length;
+            n += length;
+
+            if( windowPosition == windowLength ){
+                Publish();
+                windowStartFrame += windowLength;
+                windowPosition = 0;
+            }
+        }
+    }
+
+    void ProcessOutputBlock( const juce::AudioBuffer<float>& buffer, int startSample, int numSamples ) override
+    {
+        if( tapChannel < buffer.getNumChannels() )
+            ProcessBlock( buffer.getReadPointer(tapChannel, startSample), (unsigned int)numSamples );
+    }
+
+private:
+    PeriodicOscillator* oscillators[MAX_TONES] = {};
+    unsigned int nTones = 0, nLanes = 0;
+    int tapChannel = 0;
+
+    double fS = 48000.0;
+    std::vector<float> window;
+    double windowGain = 0.0;
+    unsigned int windowLength = 0, windowPosition = 0;
+    uint64_t windowStartFrame = 0;
+
+    //Bank state (audio thread). Padding lanes beyond nTones are computed but never published.
+    alignas(32) double coeff[MAX_TONES] = {};
+    alignas(32) double s1[MAX_TONES] = {};
+    alignas(32) double s2[MAX_TONES] = {};
+    double omega[MAX_TONES] = {};
+
+    //Published
+    std::atomic<uint32_t> sequence { 0 };
+    std::atomic<float> resultFrequency[MAX_TONES];
+    std::atomic<float> resultLevelDb[MAX_TONES];
+    std::atomic<float> resultPhase[MAX_TONES];
+
+    void LatchFrequencies( void )
+    {
+        for( unsigned int k = 0; k < nTones; k++ ){
+            omega[k] = juce::MathConstants<double>::twoPi * (double)oscillators[k]->GetCurrentFrequency() / fS;
+            coeff[k] = 2.0 * std::cos(omega[k]);
+            s1[k] = s2[k] = 0.0;
+        }
+    }
+
+    /*
+     *  After N samples: s1 - e^(-jw) s2 = e^(jw(N-1)) * sum( x[n] e^(-jwn) ).
+     *  Rotate back to the window start, then to the meter's frame 0. For A.sin(wt + p), the sum is (A/2).gain.e^(j(p - pi/2)).
+     */
+    void Publish( void )
+    {
+        sequence.fetch_add(1, std::memory_order_relaxed);       //Odd: writing
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for( unsigned int k = 0; k < nTones; k++ ){
+            const double w = omega[k];
+            const double re = s1[k] - std::cos(w) * s2[k];
+            const double im = std::sin(w) * s2[k];
+            const double rotation = -w * (double)(windowLength - 1) - std::fmod( w * (double)windowStartFrame, juce::MathConstants<double>::twoPi );
+            const double phase = std::atan2(im, re) + rotation + juce::MathConstants<double>::halfPi;
+            const double amplitude = 2.0 * std::sqrt( re * re + im * im ) / windowGain;
+
+            resultFrequency[k].store( (float)(w * fS / juce::MathConstants<double>::twoPi), std::memory_order_relaxed );
+            resultLevelDb[k].store( (float)(20.0 * std::log10( std::max( amplitude, 1e-10 ) )), std::memory_order_relaxed );
+            resultPhase[k].store( (float)juce::radiansToDegrees( std::remainder( phase, juce::MathConstants<double>::twoPi ) ), std::memory_order_relaxed );
+        }
+
+        sequence.fetch_add(1, std::memory_order_release);       //Even: complete
+    }
+};
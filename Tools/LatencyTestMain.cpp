@@ -0,0 +1,176 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Headless round trip latency and dropout test (LatencyMeter.h), for qualifying buffer sizes on a machine.
+ *
+ *  Opens an audio device with output -> input 0 looped back (cable, or a software loopback such as snd-aloop or
+ *  BlackHole), plays the MLS stimulus and reports once a second. Alongside the measured latency it prints the latency
+ *  the driver claims, and the driver's own xrun count where it has one.
+ *
+ *  --simulate runs against an in-process software loopback instead (fixed delay, optional periodic dropouts), which
+ *  is enough to check the measurement itself with no audio hardware at all.
+ *
+ *  Exits non-zero if the loopback wasn't found, or anything glitched.
+ *
+ *  Usage:
+ *      SigGenLatencyTest [--device="name"] [--rate=48000] [--buffer=256] [--seconds=10]
+ *      SigGenLatencyTest --simulate [--delay=1000] [--dropout-every=2.5] [--rate=48000] [--buffer=256] [--seconds=10]
+ */
+
+#include <JuceHeader.h>
+#include "LatencyMeter.h"
+#include "stdio.h"
+
+class LatencyTestSource : public juce::AudioSource
+{
+public:
+    LatencyTestSource( LatencyMeter& m ) : meter(m) {}
+
+    void prepareToPlay( int, double sampleRate ) override
+    {
+        meter.Prepare(sampleRate);
+        meter.Start();
+    }
+    void releaseResources() override { meter.Stop(); }
+
+    void getNextAudioBlock( const juce::AudioSourceChannelInfo& bufferToFill ) override
+    {
+        juce::AudioBuffer<float>& buffer = *bufferToFill.buffer;
+        const float* input = buffer.getNumChannels() > 0 ? buffer.getReadPointer(0, bufferToFill.startSample) : nullptr;
+        if( meter.CaptureInput( input, (unsigned int)bufferToFill.numSamples ) )
+            meter.WriteStimulus( buffer.getArrayOfWritePointers(), (unsigned int)buffer.getNumChannels(),
+                                 (unsigned int)bufferToFill.startSample, (unsigned int)bufferToFill.numSamples );
+        else
+            bufferToFill.clearActiveBufferRegion();
+    }
+
+private:
+    LatencyMeter& meter;
+};
+
+static void PrintReport( const LatencyMeter::latency_report_t& report )
+{
+    printf("latency %d samples (%.2f ms)%s  pnr %.1f dB  glitches %u  latency changes %u  overruns %u",
+           report.latencySamples, report.latencyMs, report.inverted ? " inverted" : "", report.peakToNoiseDb,
+           report.glitches, report.latencyChanges, report.overruns);
+    if( report.lastGlitchSeconds >= 0.0 )
+        printf("  last glitch %.3f s", report.lastGlitchSeconds);
+    if( !report.signalPresent )
+        printf("  NO INPUT SIGNAL");
+    printf("\r\n");
+}
+
+static int Result( const LatencyMeter::latency_report_t& report )
+{
+    return ( report.latencySamples >= 0 && report.glitches == 0 && report.latencyChanges == 0 ) ? 0 : 1;
+}
+
+//Software loopback: output is delayed by a fixed number of samples, with a whole block dropped every so often.
+static int RunSimulation( double sampleRate, int blockSize, int delay, double dropoutEvery, double seconds )
+{
+    LatencyMeter meter;
+    meter.Prepare(sampleRate);
+    meter.Start();
+
+    juce::AudioBuffer<float> buffer(2, blockSize);
+    std::vector<float> line( (size_t)juce::nextPowerOfTwo( delay + blockSize + 1 ), 0.0f );
+    const uint64_t lineMask = line.size() - 1;
+    const int64_t dropoutInterval = dropoutEvery > 0.0 ? (int64_t)(dropoutEvery * sampleRate) : 0;
+    int64_t nextDropout = dropoutInterval;
+    uint64_t frame = 0, nextReport = (uint64_t)sampleRate;
+    const uint64_t endFrame = (uint64_t)(seconds * sampleRate);
+
+    printf("Simulated loopback: %.0f Hz, %d sample blocks, %d samples delay\r\n", sampleRate, blockSize, delay);
+    while( frame < endFrame ){
+        float* data = buffer.getWritePointer(0);
+        for( int n = 0; n < blockSize; n++ )
+            data[n] = line[(frame + n - (uint64_t)delay) & lineMask];
+        if( dropoutInterval > 0 && (int64_t)frame >= nextDropout ){
+            buffer.clear(0, 0, blockSize);
+            nextDropout += dropoutInterval;
+        }
+
+        meter.CaptureInput( buffer.getReadPointer(0), (unsigned int)blockSize );
+        meter.WriteStimulus( buffer.getArrayOfWritePointers(), 2, 0, (unsigned int)blockSize );
+
+        for( int n = 0; n < blockSize; n++ )
+            line[(frame + n) & lineMask] = data[n];
+        frame += (uint64_t)blockSize;
+
+        if( frame >= nextReport ){
+            juce::Thread::sleep(20);        //Let the analysis keep up. Still much faster than real time.
+            PrintReport( meter.GetReport() );
+            nextReport += (uint64_t)sampleRate;
+        }
+    }
+
+    juce::Thread::sleep(200);
+    const LatencyMeter::latency_report_t report = meter.GetReport();
+    meter.Stop();
+    printf("Final: ");
+    PrintReport(report);
+    return Result(report);
+}
+
+static int RunDevice( const juce::String& deviceName, double sampleRate, int blockSize, double seconds )
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;       //AudioDeviceManager needs a message manager
+    juce::AudioDeviceManager deviceManager;
+
+    juce::AudioDeviceManager::AudioDeviceSetup setup;
+    setup.inputDeviceName = deviceName;
+    setup.outputDeviceName = deviceName;
+    setup.sampleRate = sampleRate;
+    setup.bufferSize = blockSize;
+    const juce::String error = deviceManager.initialise(1, 2, nullptr, true, deviceName, &setup);
+    juce::AudioIODevice* device = deviceManager.getCurrentAudioDevice();
+    if( error.isNotEmpty() || device == nullptr ){
+        printf("ERROR: Could not open audio device: %s\r\n", error.toRawUTF8());
+        return 1;
+    }
+
+    const int driverLatency = device->getInputLatencyInSamples() + device->getOutputLatencyInSamples();
+    printf("%s: %.0f Hz, %d sample buffers, driver reports %d samples round trip\r\n", device->getName().toRawUTF8(),
+           device->getCurrentSampleRate(), device->getCurrentBufferSizeSamples(), driverLatency);
+
+    LatencyMeter meter;
+    LatencyTestSource source(meter);
+    juce::AudioSourcePlayer player;
+    player.setSource(&source);
+    deviceManager.addAudioCallback(&player);
+
+    for( int second = 0; second < (int)seconds; second++ ){
+        juce::Thread::sleep(1000);
+        const int xruns = device->getXRunCount();
+        if( xruns >= 0 )
+            printf("xruns %d  ", xruns);
+        PrintReport( meter.GetReport() );
+    }
+
+    const LatencyMeter::latency_report_t report = meter.GetReport();
+    deviceManager.removeAudioCallback(&player);
+    player.setSource(nullptr);
+    deviceManager.closeAudioDevice();
+
+    printf("Final: ");
+    PrintReport(report);
+    return Result(report);
+}
+
+int main( int argc, char* argv[] )
+{
+    juce::ArgumentList args( argc, argv );
+    const double sampleRate = args.containsOption("--rate") ? args.getValueForOption("--rate").getDoubleValue() : 48000.0;
+    const int blockSize = args.containsOption("--buffer") ? args.getValueForOption("--buffer").getIntValue() : 256;
+    const double seconds = args.containsOption("--seconds") ? args.getValueForOption("--seconds").getDoubleValue() : 10.0;
+
+    if( args.containsOption("--simulate") ){
+        const int delay = args.containsOption("--delay") ? args.getValueForOption("--delay").getIntValue() : 1000;
+        const double dropoutEvery = args.containsOption("--dropout-every") ? args.getValueForOption("--dropout-every").getDoubleValue() : 0.0;
+        return RunSimulation( sampleRate, blockSize, delay, dropoutEvery, seconds );
+    }
+
+    const juce::String deviceName = args.containsOption("--device") ? args.getValueForOption("--device") : juce::String();
+    return RunDevice( deviceName, sampleRate, blockSize, seconds );
+}
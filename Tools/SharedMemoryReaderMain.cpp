@@ -0,0 +1,80 @@
+/*
+ *  @author:    Tom Wilson
+ *  @date:      18/10/26
+ *
+ *  Example consumer of the shared memory output stream (SharedMemoryOutput.h).
+ *
+ *  Maps the ring read-only and reports, once a second, the RMS level of each channel, the number of blocks
+ *  published, and any frames dropped (reader too slow) or torn (writer lapped a span while it was being read).
+ *  Samples are read in place from the mapping: no copies, no syscalls in the read loop.
+ *
+ *  Usage:
+ *      SigGenShmReader [--name=/siggen_out] [--seconds=10]
+ */
+
+#include <JuceHeader.h>
+#include "SharedMemoryOutput.h"
+#include "stdio.h"
+
+int main( int argc, char* argv[] )
+{
+    juce::ArgumentList args( argc, argv );
+    const juce::String name = args.containsOption("--name") ? args.getValueForOption("--name") : juce::String("/siggen_out");
+    const double seconds = args.containsOption("--seconds") ? args.getValueForOption("--seconds").getDoubleValue() : 10.0;
+
+    SharedMemoryOutputReader reader;
+    if( !reader.Open( name.toRawUTF8() ) ){
+        printf("ERROR: Could not open shared memory stream %s\r\n", name.toRawUTF8());
+        return 1;
+    }
+
+    const unsigned int numChannels = reader.GetNumChannels();
+    const double sampleRate = reader.GetSampleRate();
+    printf("Reading %s: %u channels, %u frame ring, %.0f Hz\r\n", name.toRawUTF8(), numChannels, reader.GetCapacityFrames(), sampleRate);
+
+    std::vector<double> sumSquares(numChannels, 0.0);
+    uint64_t framesThisReport = 0, tornSpans = 0;
+    const double endTime = juce::Time::getMillisecondCounterHiRes() + seconds * 1000.0;
+    double nextReport = juce::Time::getMillisecondCounterHiRes() + 1000.0;
+
+    while( juce::Time::getMillisecondCounterHiRes() < endTime && reader.IsWriterAlive() ){
+        const unsigned int available = (unsigned int)std::min<uint64_t>( reader.GetAvailableFrames(), reader.GetCapacityFrames() / 2 );
+        if( available == 0 ){
+            juce::Thread::sleep(2);
+            continue;
+        }
+
+        std::vector<double> spanSquares(numChannels, 0.0);
+        for( unsigned int channel = 0; channel < numChannels; channel++ ){
+            const SharedMemoryOutputReader::span_t span = reader.GetReadSpan(channel, available);
+            for( unsigned int n = 0; n < span.firstLength; n++ )  spanSquares[channel] += span.first[n] * span.first[n];
+            for( unsigned int n = 0; n < span.secondLength; n++ ) spanSquares[channel] += span.second[n] * span.second[n];
+        }
+
+        if( reader.Validate() ){
+            for( unsigned int channel = 0; channel < numChannels; channel++ )
+                sumSquares[channel] += spanSquares[channel];
+            framesThisReport += available;
+        }else{
+            tornSpans++;
+        }
+        reader.Advance(available);
+
+        if( juce::Time::getMillisecondCounterHiRes() >= nextReport ){
+            printf("seq %llu  frames %llu  dropped %llu  torn %llu  rms:",
+                   (unsigned long long)reader.GetBlockSequence(), (unsigned long long)framesThisReport,
+                   (unsigned long long)reader.GetDroppedFrames(), (unsigned long long)tornSpans);
+            for( unsigned int channel = 0; channel < numChannels; channel++ ){
+                printf(" %.4f", framesThisReport ? std::sqrt( sumSquares[channel] / (double)framesThisReport ) : 0.0);
+                sumSquares[channel] = 0.0;
+            }
+            printf("\r\n");
+            framesThisReport = 0;
+            nextReport += 1000.0;
+        }
+    }
+
+    if( !reader.IsWriterAlive() )
+        printf("Writer closed the stream\r\n");
+    return 0;
+}